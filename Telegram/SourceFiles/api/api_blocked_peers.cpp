@@ -225,4 +225,47 @@ void BlockedPeers::request(int offset, Fn<void(BlockedPeers::Slice)> done) {
 	}).send();
 }
 
+// kg begin
+void BlockedPeers::loadAll(
+		Fn<bool(const Slice&)> page,
+		Fn<void(bool)> finished) {
+	_loadAllPage = std::move(page);
+	_loadAllFinished = std::move(finished);
+	if (_loadAllRequestId) {
+		_api.request(base::take(_loadAllRequestId)).cancel();
+	}
+	_loadAllOffset = 0;
+	loadAllNext();
+}
+
+void BlockedPeers::loadAllNext() {
+	const auto finish = [=](bool complete) {
+		_loadAllPage = nullptr;
+		if (const auto onstack = base::take(_loadAllFinished)) {
+			onstack(complete);
+		}
+	};
+	_loadAllRequestId = _api.request(MTPcontacts_GetBlocked(
+		MTP_flags(0),
+		MTP_int(_loadAllOffset),
+		MTP_int(kBlockedPerPage)
+	)).done([=](const MTPcontacts_Blocked &result) {
+		_loadAllRequestId = 0;
+		const auto slice = TLToSlice(result, _session->data());
+		_loadAllOffset += slice.list.size();
+		if (_loadAllPage && !_loadAllPage(slice)) {
+			_loadAllPage = nullptr;
+			_loadAllFinished = nullptr;
+		} else if (slice.list.isEmpty() || _loadAllOffset >= slice.total) {
+			finish(true);
+		} else {
+			loadAllNext();
+		}
+	}).fail([=] {
+		_loadAllRequestId = 0;
+		finish(false);
+	}).send();
+}
+// kg end
+
 } // namespace Api
@@ -25,10 +25,19 @@ namespace {
 constexpr auto kPreloadIfLess = 5;
 constexpr auto kFirstRequestLimit = 10;
 constexpr auto kNextRequestLimit = 100;
+constexpr auto kRecountPerPage = 100; // kg
+constexpr auto kRecountMaxInFlight = 4; // kg
+constexpr auto kReactionAuthorsLimit = 4096; // kg
+constexpr auto kReadContentsDelay = crl::time(500); // kg
+constexpr auto kReadContentsMaxDelay = 3 * crl::time(1000); // kg
+constexpr auto kReadContentsPerRequest = 100; // kg
 
 } // namespace
 
-UnreadThings::UnreadThings(not_null<ApiWrap*> api) : _api(api) {
+UnreadThings::UnreadThings(not_null<ApiWrap*> api)
+: _api(api)
+, _reactionAuthorsTimer([=] { sendReactionAuthorsRequests(); }) // kg
+, _readContentsTimer([=] { sendReadContentsRequests(); }) { // kg
 }
 
 bool UnreadThings::trackMentions(Data::Thread *thread) const {
@@ -87,9 +96,23 @@ void UnreadThings::cancelRequests(not_null<Data::Thread*> thread) {
 	if (const auto requestId = _mentionsRequests.take(thread)) {
 		_api->request(*requestId).cancel();
 	}
+	// kg begin
+	if (const auto recount = _mentionsRecounts.take(thread)) {
+		if (recount->sent) {
+			_api->request(recount->requestId).cancel();
+			--_mentionsRecountsInFlight;
+			sendMentionsRecounts();
+		} else {
+			_mentionsRecountsQueue.erase(
+				ranges::remove(_mentionsRecountsQueue, thread),
+				end(_mentionsRecountsQueue));
+		}
+	}
+	// kg end
 	if (const auto requestId = _reactionsRequests.take(thread)) {
 		_api->request(*requestId).cancel();
 	}
+	_reactionsRecounts.remove(thread); // kg
 }
 
 void UnreadThings::requestMentions(
@@ -165,16 +188,49 @@ void UnreadThings::requestReactions(
 void UnreadThings::resetUnreadMentionsCountExcludingBlockedUsers(
 		not_null<Data::Thread*> thread,
 		const int total_unread_mentions_count) {
-	if (!_api->session().kgMode()
+	// Recounts of a whole dialogs slice are queued together and sent
+	// a few at a time, each one paging by kRecountPerPage messages.
+	const auto i = _mentionsRecounts.find(thread);
+	if (i != end(_mentionsRecounts)) {
+		i->second.total = total_unread_mentions_count;
+		return;
+	} else if (!_api->session().kgMode()
 	    || total_unread_mentions_count == 0
 		|| !trackMentions(thread)
 		|| _mentionsRequests.contains(thread)) {
 		thread->unreadMentions().setCount(total_unread_mentions_count);
 		return;
 	}
-	const auto offsetId = MsgId(1);
-	const auto limit = total_unread_mentions_count; // kNextRequestLimit; ?
-	const auto addOffset = -limit;
+	_mentionsRecounts.emplace(thread, MentionsRecount{
+		.total = total_unread_mentions_count,
+		.offsetId = MsgId(1),
+	});
+	_mentionsRecountsQueue.push_back(thread);
+	sendMentionsRecounts();
+}
+
+void UnreadThings::sendMentionsRecounts() {
+	while (_mentionsRecountsInFlight < kRecountMaxInFlight
+		&& !_mentionsRecountsQueue.empty()) {
+		const auto thread = _mentionsRecountsQueue.front();
+		_mentionsRecountsQueue.pop_front();
+		const auto i = _mentionsRecounts.find(thread);
+		if (i != end(_mentionsRecounts)) {
+			++_mentionsRecountsInFlight;
+			i->second.sent = true;
+			sendMentionsRecount(thread, i->second);
+		}
+	}
+}
+
+void UnreadThings::sendMentionsRecount(
+		not_null<Data::Thread*> thread,
+		MentionsRecount &recount) {
+	const auto offsetId = recount.offsetId;
+	const auto limit = std::min(
+		recount.total - recount.received,
+		kRecountPerPage);
+	const auto addOffset = recount.received ? -(limit + 1) : -limit;
 	const auto maxId = 0;
 	const auto minId = 0;
 	const auto history = thread->owningHistory();
@@ -190,44 +246,69 @@ void UnreadThings::resetUnreadMentionsCountExcludingBlockedUsers(
 		MTP_int(maxId),
 		MTP_int(minId)
 	)).done([=](const MTPmessages_Messages &result) {
-		_mentionsRequests.remove(thread);
-
-		std::cout << "UnreadThings::resetUnreadMentionsCountExcludingBlockedUsers done:\n";
-
-		const auto list = result.match([](const MTPDmessages_messagesNotModified &) {
+		const auto i = _mentionsRecounts.find(thread);
+		if (i == end(_mentionsRecounts)) {
+			return;
+		}
+		auto &recount = i->second;
+		recount.requestId = 0;
+		const auto list = result.match([](
+				const MTPDmessages_messagesNotModified &) {
 			return (const QVector<MTPMessage>*)nullptr;
 		}, [](const auto &data) {
 			return &data.vmessages().v;
 		});
-		auto ids_to_read_contents = QVector<MTPint>();
+		auto blocked = QVector<MTPint>();
 		if (list) {
+			const auto &session = _api->session();
 			for (const auto &message : *list) {
-
-				std::cout << "Author ID : " << AuthorIDFromMessage(message) << "\n";
-
-				if (_api->session().kgModeAndUserIsBlocked(AuthorIDFromMessage(message))) {
-					ids_to_read_contents.push_back(MTP_int(IdFromMessage(message)));
+				const auto id = IdFromMessage(message);
+				recount.offsetId = std::max(recount.offsetId, id);
+				if (session.kgModeAndUserIsBlocked(
+						AuthorIDFromMessage(message))) {
+					blocked.push_back(MTP_int(id));
 				}
 			}
 		}
-		readMessageContents(thread->peer(), ids_to_read_contents);
-        const auto updated_count = total_unread_mentions_count - ids_to_read_contents.size();
-
-		std::cout << "unread_mentions_count_from_non_blocked : " << updated_count << "\n";
-
-		thread->unreadMentions().setCount(updated_count);
+		const auto received = list ? int(list->size()) : 0;
+		recount.received += received;
+		recount.blocked += blocked.size();
+		readMessageContents(thread->peer(), blocked);
+
+		// Counts only go down as pages arrive, so apply each of them.
+		thread->unreadMentions().setCount(
+			std::max(recount.total - recount.blocked, 0));
+		if (received < limit || recount.received >= recount.total) {
+			finishMentionsRecount(thread);
+		} else {
+			sendMentionsRecount(thread, recount);
+		}
 	}).fail([=] {
-		_mentionsRequests.remove(thread);
-		thread->unreadMentions().setCount(total_unread_mentions_count);
+		const auto i = _mentionsRecounts.find(thread);
+		if (i != end(_mentionsRecounts)) {
+			thread->unreadMentions().setCount(
+				std::max(i->second.total - i->second.blocked, 0));
+			finishMentionsRecount(thread);
+		}
 	}).send();
 
-	_mentionsRequests.emplace(thread, requestId);
+	recount.requestId = requestId;
+}
+
+void UnreadThings::finishMentionsRecount(not_null<Data::Thread*> thread) {
+	_mentionsRecounts.remove(thread);
+	--_mentionsRecountsInFlight;
+	sendMentionsRecounts();
 }
 
 void UnreadThings::resetUnreadReactionsCountExcludingBlockedUsers(
 		not_null<Data::Thread*> thread,
 		const int total_unread_reactions_count) {
-	if (!_api->session().kgMode()
+	if (const auto i = _reactionsRecounts.find(thread)
+		; i != end(_reactionsRecounts)) {
+		i->second.total = total_unread_reactions_count;
+		return;
+	} else if (!_api->session().kgMode()
 	    || total_unread_reactions_count == 0
 		|| !trackReactions(thread)
 		|| _reactionsRequests.contains(thread)) {
@@ -254,98 +335,52 @@ void UnreadThings::resetUnreadReactionsCountExcludingBlockedUsers(
 	)).done([=](const MTPmessages_Messages &result) {
 		_reactionsRequests.remove(thread);
 
-		std::cout << "UnreadThings::resetUnreadReactionsCountExcludingBlockedUsers done:\n";
-
-		const auto list = result.match([](const MTPDmessages_messagesNotModified &) {
+		const auto list = result.match([](
+				const MTPDmessages_messagesNotModified &) {
 			return (const QVector<MTPMessage>*)nullptr;
 		}, [](const auto &data) {
 			return &data.vmessages().v;
 		});
-		if (!list || list->size() == 0) {
+		if (!list || list->isEmpty()) {
 			thread->unreadReactions().setCount(total_unread_reactions_count);
 			return;
 		}
-
-		// request MTPmessages_GetMessagesReactions with messages ids from list
-
-		auto ids = QVector<MTPint>();
-		ids.reserve(list->size());
+		const auto peer = thread->peer();
+		auto recount = ReactionsRecount{
+			.total = total_unread_reactions_count,
+		};
+		recount.ids.reserve(list->size());
 		for (const auto &message : *list) {
-			// std::cout << "Author ID : " << AuthorIDFromMessage(message) << "\n";
-			ids.push_back(MTP_int(IdFromMessage(message)));
-		}
-		// or this way
-		// ranges::transform(
-		// 	*list,
-		// 	ranges::back_inserter(ids),
-		// 	[](const auto &message) { return MTP_int(IdFromMessage(message)); });
-
-		_api->request(MTPmessages_GetMessagesReactions(
-			history->peer->input,
-			MTP_vector<MTPint>(ids)
-		)).done([=](const MTPUpdates &updates) {
-			const auto processUpdates = [&](const auto &updates) {
-				auto ids_to_read_contents = QVector<MTPint>();
-				for (const auto &update : updates.v) {
-					if (update.type() == mtpc_updateMessageReactions) {
-						const auto &d = update.c_updateMessageReactions();
-
-						std::cout << "mtpc_updateMessageReactions - message ID : " << d.vmsg_id().v << "\n";
-
-						if (!hasUnreadReactionFromNonBlockedUser(d.vreactions())) {
-							ids_to_read_contents.push_back(MTP_int(d.vmsg_id().v));
-						}
+			const auto id = IdFromMessage(message);
+			const auto itemId = FullMsgId(peer->id, id);
+			message.match([&](const MTPDmessage &data) {
+				if (const auto reactions = data.vreactions()) {
+					if (!reactions->data().is_min()) {
+						rememberReactions(itemId, *reactions);
 					}
 				}
-				readMessageContents(thread->peer(), ids_to_read_contents);
-				const auto updated_count = total_unread_reactions_count - ids_to_read_contents.size();
-
-				std::cout << "unread_reactions_count_from_non_blocked : " << updated_count << "\n";
-
-				thread->unreadReactions().setCount(updated_count);
-			};
-
-			switch (updates.type()) {
-			case mtpc_updates: {
-				auto &d = updates.c_updates();
-				// std::cout << "mtpc_updates:" << "\n";
-				processUpdates(d.vupdates());
-			} break;
-
-			case mtpc_updatesCombined: {
-				auto &d = updates.c_updatesCombined();
-				// std::cout << "mtpc_updatesCombined:" << "\n";
-				processUpdates(d.vupdates());
-			} break;
-
-			// case mtpc_updateShort: {
-			// 	auto &d = updates.c_updateShort();
-			// 	std::cout << "mtpc_updateShort:" << "\n";
-			// 	feedUpdate(d.vupdate());
-			// } break;
-
-			// case mtpc_updateShortMessage: {
-			// 	auto &d = updates.c_updateShortMessage();
-			// 	std::cout << "mtpc_updateShortMessage:" << "\n";
-			// } break;
-
-			// case mtpc_updateShortChatMessage: {
-			// 	auto &d = updates.c_updateShortChatMessage();
-			// 	std::cout << "mtpc_updateShortChatMessage:" << "\n";
-			// } break;
-
-			// case mtpc_updateShortSentMessage: {
-			// 	auto &d = updates.c_updateShortSentMessage();
-			// 	std::cout << "mtpc_updateShortSentMessage:" << "\n";
-			// } break;
-
-			// case mtpc_updatesTooLong: {
-			// 	std::cout << "mtpc_updateShortSentMessage:" << "\n";
-			// } break;
+			}, [](const auto &) {
+			});
+			recount.ids.push_back(id);
+			if (!reactionAuthors(itemId)) {
+				recount.missing.emplace(id);
 			}
-		}).fail([=] {
-			thread->unreadReactions().setCount(total_unread_reactions_count);
-		}).send();
+		}
+		if (recount.missing.empty()) {
+			_reactionsRecounts.emplace(thread, std::move(recount));
+			finishReactionsRecount(thread);
+			return;
+		}
+
+		// Misses of all threads are requested together, one per peer.
+		auto &missing = _reactionAuthorsMissing[peer];
+		for (const auto id : recount.missing) {
+			missing.emplace(id);
+		}
+		_reactionsRecounts.emplace(thread, std::move(recount));
+		if (!_reactionAuthorsTimer.isActive()) {
+			_reactionAuthorsTimer.callOnce(0);
+		}
 	}).fail([=] {
 		_reactionsRequests.remove(thread);
 		thread->unreadReactions().setCount(total_unread_reactions_count);
@@ -354,6 +389,150 @@ void UnreadThings::resetUnreadReactionsCountExcludingBlockedUsers(
 	_reactionsRequests.emplace(thread, requestId);
 }
 
+void UnreadThings::sendReactionAuthorsRequests() {
+	for (auto i = begin(_reactionAuthorsMissing)
+		; i != end(_reactionAuthorsMissing);) {
+		const auto peer = i->first;
+		if (_reactionAuthorsRequests.contains(peer)) {
+			++i;
+			continue;
+		}
+		const auto requested = std::move(i->second);
+		i = _reactionAuthorsMissing.erase(i);
+
+		auto ids = QVector<MTPint>();
+		ids.reserve(requested.size());
+		for (const auto id : requested) {
+			ids.push_back(MTP_int(id));
+		}
+		const auto requestId = _api->request(MTPmessages_GetMessagesReactions(
+			peer->input,
+			MTP_vector<MTPint>(ids)
+		)).done([=](const MTPUpdates &result) {
+			const auto remember = [&](const MTPUpdate &update) {
+				if (update.type() == mtpc_updateMessageReactions) {
+					const auto &d = update.c_updateMessageReactions();
+					rememberReactions(
+						FullMsgId(peerFromMTP(d.vpeer()), d.vmsg_id().v),
+						d.vreactions());
+				}
+			};
+			result.match([&](const MTPDupdates &data) {
+				for (const auto &update : data.vupdates().v) {
+					remember(update);
+				}
+			}, [&](const MTPDupdatesCombined &data) {
+				for (const auto &update : data.vupdates().v) {
+					remember(update);
+				}
+			}, [&](const MTPDupdateShort &data) {
+				remember(data.vupdate());
+			}, [](const auto &) {
+			});
+			reactionAuthorsReceived(peer, requested);
+		}).fail([=] {
+			reactionAuthorsReceived(peer, requested);
+		}).send();
+		_reactionAuthorsRequests.emplace(peer, requestId);
+	}
+}
+
+void UnreadThings::reactionAuthorsReceived(
+		not_null<PeerData*> peer,
+		const base::flat_set<MsgId> &requested) {
+	_reactionAuthorsRequests.remove(peer);
+
+	auto finished = std::vector<not_null<Data::Thread*>>();
+	for (auto &[thread, recount] : _reactionsRecounts) {
+		if (thread->peer() != peer || recount.missing.empty()) {
+			continue;
+		}
+		for (const auto id : requested) {
+			recount.missing.remove(id);
+		}
+		if (recount.missing.empty()) {
+			finished.push_back(thread);
+		}
+	}
+	for (const auto thread : finished) {
+		finishReactionsRecount(thread);
+	}
+	if (_reactionAuthorsMissing.contains(peer)) {
+		sendReactionAuthorsRequests();
+	}
+}
+
+void UnreadThings::finishReactionsRecount(not_null<Data::Thread*> thread) {
+	const auto recount = _reactionsRecounts.take(thread);
+	if (!recount) {
+		return;
+	}
+	const auto &session = _api->session();
+	const auto peerId = thread->peer()->id;
+	auto ids_to_read_contents = QVector<MTPint>();
+	for (const auto id : recount->ids) {
+		const auto authors = reactionAuthors(FullMsgId(peerId, id));
+		if (!authors) {
+			continue;
+		}
+		const auto hasFromNonBlocked = ranges::any_of(*authors, [&](
+				BareId authorId) {
+			return !session.kgModeAndUserIsBlocked(authorId);
+		});
+		if (!hasFromNonBlocked) {
+			ids_to_read_contents.push_back(MTP_int(id));
+		}
+	}
+	readMessageContents(thread->peer(), ids_to_read_contents);
+	thread->unreadReactions().setCount(
+		std::max(recount->total - int(ids_to_read_contents.size()), 0));
+}
+
+void UnreadThings::rememberReactions(
+		FullMsgId itemId,
+		const QVector<MTPMessagePeerReaction> &recent) {
+	auto authors = std::vector<BareId>();
+	for (const auto &reaction : recent) {
+		const auto &data = reaction.data();
+		if (data.is_unread()) {
+			authors.push_back(peerFromMTP(data.vpeer_id()).value);
+		}
+	}
+	if (reactionAuthors(itemId)) {
+		_reactionAuthors[itemId].ids = std::move(authors);
+		return;
+	} else if (_reactionAuthors.size() >= kReactionAuthorsLimit) {
+		_reactionAuthors.erase(_reactionAuthorsUsed.front());
+		_reactionAuthorsUsed.pop_front();
+	}
+	_reactionAuthors.emplace(itemId, ReactionAuthors{
+		.ids = std::move(authors),
+		.used = _reactionAuthorsUsed.insert(
+			end(_reactionAuthorsUsed),
+			itemId),
+	});
+}
+
+const std::vector<BareId> *UnreadThings::reactionAuthors(FullMsgId itemId) {
+	const auto i = _reactionAuthors.find(itemId);
+	if (i == end(_reactionAuthors)) {
+		return nullptr;
+	}
+	_reactionAuthorsUsed.splice(
+		end(_reactionAuthorsUsed),
+		_reactionAuthorsUsed,
+		i->second.used);
+	return &i->second.ids;
+}
+
+void UnreadThings::rememberReactions(
+		FullMsgId itemId,
+		const MTPMessageReactions &data) {
+	rememberReactions(
+		itemId,
+		data.data().vrecent_reactions().value_or_empty());
+}
+
 // see Data::Reactions::HasUnread(d.vreactions())
 bool UnreadThings::hasUnreadReactionFromNonBlockedUser(const MTPMessageReactions &data) {
 	return data.match([&](const MTPDmessageReactions &data) {
@@ -377,30 +556,92 @@ bool UnreadThings::hasUnreadReactionFromNonBlockedUser(const MTPMessageReactions
 void UnreadThings::readMessageContents(not_null<PeerData*> peer, const QVector<MTPint>& ids) {
 	if (ids.isEmpty()) return;
 
-	if (const auto channel = peer->asChannel()) {
+	// Debounced like Histories::sendReadRequests(), each new id delays
+	// the request a bit, but never more than kReadContentsMaxDelay.
+	const auto now = crl::now();
+	auto &queue = _readContents[peer->asChannel()];
+	const auto was = int(queue.ids.size());
+	for (const auto &id : ids) {
+		queue.ids.emplace(id.v);
+	}
+	if (!queue.queuedWhen) {
+		queue.queuedWhen = now;
+	}
+	queue.willSendWhen = std::min(
+		now + kReadContentsDelay,
+		queue.queuedWhen + kReadContentsMaxDelay);
+
+	auto &stats = _readContentsStats;
+	stats.queued += int(queue.ids.size()) - was;
+	stats.maxQueued = std::max(stats.maxQueued, stats.queued);
+	if (queue.ids.size() >= kReadContentsPerRequest) {
+		sendReadContentsRequests();
+	} else if (!_readContentsTimer.isActive()) {
+		_readContentsTimer.callOnce(kReadContentsDelay);
+	}
+}
 
-		for (const auto &id : ids) {
-			std::cout << "UnreadThings::readMessageContents from channel : " << id.v << "\n";
+void UnreadThings::sendReadContentsRequests() {
+	const auto now = crl::now();
+	auto next = std::optional<crl::time>();
+	for (auto i = begin(_readContents); i != end(_readContents);) {
+		auto &queue = i->second;
+		if (queue.willSendWhen <= now
+			|| queue.ids.size() >= kReadContentsPerRequest) {
+			sendReadContentsRequest(i->first, queue);
 		}
-
-		_api->request(MTPchannels_ReadMessageContents(
-			channel->inputChannel,
-			MTP_vector<MTPint>(ids)
-		)).done([=](const auto &result) {
-			std::cout << "ReadMessageContents DONE by channel\n";
-		}).send();
+		if (queue.ids.empty()) {
+			i = _readContents.erase(i);
+			continue;
+		} else if (!next || *next > queue.willSendWhen) {
+			next = queue.willSendWhen;
+		}
+		++i;
+	}
+	if (next.has_value()) {
+		_readContentsTimer.callOnce(std::max(*next - now, crl::time(0)));
 	} else {
+		_readContentsTimer.cancel();
+	}
+}
 
-		for (const auto &id : ids) {
-			std::cout << "UnreadThings::readMessageContents : " << id.v << "\n";
+void UnreadThings::sendReadContentsRequest(
+		ChannelData *channel,
+		ReadContentsQueue &queue) {
+	auto &stats = _readContentsStats;
+	stats.lastLatency = crl::now() - queue.queuedWhen;
+	stats.maxLatency = std::max(stats.maxLatency, stats.lastLatency);
+
+	while (!queue.ids.empty()) {
+		const auto count = std::min(
+			int(queue.ids.size()),
+			kReadContentsPerRequest);
+		auto ids = QVector<MTPint>();
+		ids.reserve(count);
+		for (auto i = 0; i != count; ++i) {
+			ids.push_back(MTP_int(queue.ids[i]));
+		}
+		queue.ids.erase(begin(queue.ids), begin(queue.ids) + count);
+		stats.queued -= count;
+		++stats.requests;
+
+		DEBUG_LOG(("KG: reading contents of %1 messages, "
+			"waited %2 ms, %3 more queued."
+			).arg(count
+			).arg(stats.lastLatency
+			).arg(stats.queued));
+		if (channel) {
+			_api->request(MTPchannels_ReadMessageContents(
+				channel->inputChannel,
+				MTP_vector<MTPint>(std::move(ids))
+			)).send();
+		} else {
+			_api->request(MTPmessages_ReadMessageContents(
+				MTP_vector<MTPint>(std::move(ids))
+			)).send();
 		}
-
-		_api->request(MTPmessages_ReadMessageContents(
-			MTP_vector<MTPint>(ids)
-		)).done([=](const MTPmessages_AffectedMessages &result) {
-			std::cout << "ReadMessageContents DONE by message\n";
-		}).send();
 	}
+	queue.queuedWhen = 0;
 }
 
 // kg end
@@ -7,6 +7,9 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 */
 #pragma once
 
+#include "base/timer.h" // kg
+#include "data/data_types.h" // kg FullMsgIdHash
+
 class ApiWrap;
 class PeerData;
 class ChannelData;
@@ -40,10 +43,68 @@ public:
 		not_null<Data::Thread*> thread,
 		const int total_unread_reactions_count);
 	bool hasUnreadReactionFromNonBlockedUser(const MTPMessageReactions &data);
+
+	// Authors of unread reactions, kept to answer recounts locally.
+	void rememberReactions(
+		FullMsgId itemId,
+		const QVector<MTPMessagePeerReaction> &recent);
+	void rememberReactions(
+		FullMsgId itemId,
+		const MTPMessageReactions &data);
 	void readMessageContents(not_null<PeerData*> peer, const QVector<MTPint>& ids);
+
+	struct ReadContentsStats {
+		int queued = 0;
+		int maxQueued = 0;
+		int requests = 0;
+		crl::time lastLatency = 0;
+		crl::time maxLatency = 0;
+	};
+	[[nodiscard]] const ReadContentsStats &readContentsStats() const {
+		return _readContentsStats;
+	}
     // kg end
 
 private:
+	// kg begin
+	struct MentionsRecount {
+		int total = 0;
+		int received = 0;
+		int blocked = 0;
+		MsgId offsetId = 0;
+		mtpRequestId requestId = 0; // Apart from the preload requests.
+		bool sent = false;
+	};
+	void sendMentionsRecounts();
+	void sendMentionsRecount(
+		not_null<Data::Thread*> thread,
+		MentionsRecount &recount);
+	void finishMentionsRecount(not_null<Data::Thread*> thread);
+
+	struct ReactionsRecount {
+		int total = 0;
+		std::vector<MsgId> ids;
+		base::flat_set<MsgId> missing;
+	};
+	[[nodiscard]] const std::vector<BareId> *reactionAuthors(
+		FullMsgId itemId);
+	void sendReactionAuthorsRequests();
+	void reactionAuthorsReceived(
+		not_null<PeerData*> peer,
+		const base::flat_set<MsgId> &requested);
+	void finishReactionsRecount(not_null<Data::Thread*> thread);
+
+	struct ReadContentsQueue {
+		base::flat_set<MsgId> ids;
+		crl::time queuedWhen = 0;
+		crl::time willSendWhen = 0;
+	};
+	void sendReadContentsRequests();
+	void sendReadContentsRequest(
+		ChannelData *channel,
+		ReadContentsQueue &queue);
+	// kg end
+
 	void preloadEnoughMentions(not_null<Data::Thread*> thread);
 	void preloadEnoughReactions(not_null<Data::Thread*> thread);
 
@@ -55,6 +116,34 @@ private:
 	base::flat_map<not_null<Data::Thread*>, mtpRequestId> _mentionsRequests;
 	base::flat_map<not_null<Data::Thread*>, mtpRequestId> _reactionsRequests;
 
+	// kg begin
+	base::flat_map<not_null<Data::Thread*>, MentionsRecount> _mentionsRecounts;
+	std::deque<not_null<Data::Thread*>> _mentionsRecountsQueue;
+	int _mentionsRecountsInFlight = 0;
+
+	// Least recently used first, limited by kReactionAuthorsLimit.
+	struct ReactionAuthors {
+		std::vector<BareId> ids;
+		std::list<FullMsgId>::iterator used;
+	};
+	std::unordered_map<
+		FullMsgId,
+		ReactionAuthors,
+		FullMsgIdHash> _reactionAuthors;
+	std::list<FullMsgId> _reactionAuthorsUsed;
+	base::flat_map<not_null<Data::Thread*>, ReactionsRecount> _reactionsRecounts;
+	base::flat_map<
+		not_null<PeerData*>,
+		base::flat_set<MsgId>> _reactionAuthorsMissing;
+	base::flat_map<not_null<PeerData*>, mtpRequestId> _reactionAuthorsRequests;
+	base::Timer _reactionAuthorsTimer;
+
+	// Non-channel messages are read all together, channel ones by channel.
+	base::flat_map<ChannelData*, ReadContentsQueue> _readContents;
+	ReadContentsStats _readContentsStats;
+	base::Timer _readContentsTimer;
+	// kg end
+
 };
 
 } // namespace Api
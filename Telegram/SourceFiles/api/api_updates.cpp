@@ -18,6 +18,11 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "api/api_user_privacy.h"
 #include "api/api_unread_things.h"
 #include "api/api_transcribes.h"
+#include "api/api_updates_catch_up.h"
+#include "api/api_updates_channels.h"
+#include "api/api_updates_dispatcher.h"
+#include "api/api_updates_recorder.h"
+#include "api/api_updates_seq.h"
 #include "main/main_session.h"
 #include "main/main_account.h"
 #include "mtproto/mtp_instance.h"
@@ -102,6 +107,34 @@ void ProcessScheduledMessageWithElapsedTime(
 	}
 }
 
+// While channels wait for getChannelDifference the date is held back,
+// so that the next getDifference returns their messages as well.
+[[nodiscard]] int32 DifferenceDate(
+		int32 known,
+		int32 received,
+		bool heldBack) {
+	return (known < received && !heldBack) ? received : known;
+}
+
+void RequestDifference(
+		not_null<Main::Session*> session,
+		int32 pts,
+		int32 date,
+		int32 qts,
+		Fn<void(const MTPupdates_Difference &result)> done,
+		Fn<void(const MTP::Error &error)> fail) {
+	session->api().request(MTPupdates_GetDifference(
+		MTP_flags(0),
+		MTP_int(pts),
+		MTPint(), // pts_limit
+		MTPint(), // pts_total_limit
+		MTP_int(date),
+		MTP_int(qts),
+		MTPint() // qts_limit
+	)).done(std::move(done)).fail(std::move(fail)).send();
+	session->updatesCatchUp().requested();
+}
+
 bool IsForceLogoutNotification(const MTPDupdateServiceNotification &data) {
 	return qs(data.vtype()).startsWith(u"AUTH_KEY_DROP_"_q);
 }
@@ -241,6 +274,14 @@ Updates::Updates(not_null<Main::Session*> session)
 , _idleFinishTimer([=] { checkIdleFinish(); }) {
 	_ptsWaiter.setRequesting(true);
 
+	session->updatesDispatcher().typing().setHandler([=](
+			PeerId peerId,
+			MsgId rootId,
+			PeerId fromId,
+			const MTPSendMessageAction &action) {
+		handleSendActionUpdate(peerId, rootId, fromId, action);
+	});
+
 	session->account().mtpUpdates(
 	) | rpl::start_with_next([=](const MTPUpdates &updates) {
 		mtpUpdateReceived(updates);
@@ -317,15 +358,16 @@ void Updates::feedUpdateVector(
 	} else if (policy == SkipUpdatePolicy::SkipExceptGroupCallParticipants) {
 		return;
 	}
-	for (const auto &entry : std::as_const(list)) {
-		const auto type = entry.type();
+	auto &dispatcher = session().updatesDispatcher();
+	for (const auto entry : dispatcher.schedule(list)) {
+		const auto type = entry->type();
 		if ((policy == SkipUpdatePolicy::SkipMessageIds
 			&& type == mtpc_updateMessageID)
 			|| (policy == SkipUpdatePolicy::SkipExceptGroupCallParticipants
 				&& type != mtpc_updateGroupCallParticipants)) {
 			continue;
 		}
-		feedUpdate(entry);
+		dispatcher.dispatch(*entry, [&] { feedUpdate(*entry); });
 	}
 	session().data().sendHistoryChangeNotifications();
 }
@@ -342,9 +384,10 @@ void Updates::setState(int32 pts, int32 date, int32 qts, int32 seq) {
 	if (pts) {
 		_ptsWaiter.init(pts);
 	}
-	if (_updatesDate < date && !_byMinChannelTimer.isActive()) {
-		_updatesDate = date;
-	}
+	_updatesDate = DifferenceDate(
+		_updatesDate,
+		date,
+		_byMinChannelTimer.isActive());
 	if (qts && _updatesQts < qts) {
 		_updatesQts = qts;
 	}
@@ -353,20 +396,11 @@ void Updates::setState(int32 pts, int32 date, int32 qts, int32 seq) {
 		if (_bySeqTimer.isActive()) {
 			_bySeqTimer.cancel();
 		}
-		while (!_bySeqUpdates.empty()) {
-			const auto s = _bySeqUpdates.front().first;
-			if (s <= seq + 1) {
-				const auto v = _bySeqUpdates.front().second;
-				_bySeqUpdates.erase(_bySeqUpdates.begin());
-				if (s == seq + 1) {
-					return applyUpdates(v);
-				}
-			} else {
-				if (!_bySeqTimer.isActive()) {
-					_bySeqTimer.callOnce(PtsWaiter::kWaitForSkippedTimeout);
-				}
-				break;
-			}
+		auto &buffer = session().updatesSeqBuffer();
+		if (const auto next = buffer.takeNext(seq)) {
+			return applyUpdates(*next);
+		} else if (!buffer.empty()) {
+			_bySeqTimer.callOnce(PtsWaiter::kWaitForSkippedTimeout);
 		}
 	}
 }
@@ -374,6 +408,7 @@ void Updates::setState(int32 pts, int32 date, int32 qts, int32 seq) {
 void Updates::channelDifferenceDone(
 		not_null<ChannelData*> channel,
 		const MTPupdates_ChannelDifference &difference) {
+	session().updatesRecorder().record(difference);
 	_channelFailDifferenceTimeout.remove(channel);
 
 	const auto timeout = difference.match([&](const auto &data) {
@@ -418,7 +453,10 @@ void Updates::channelDifferenceDone(
 			"{ good - after not final channelDifference was received }%1"
 			).arg(_session->mtp().isTestMode() ? " TESTMODE" : ""));
 		getChannelDifference(channel);
-	} else if (ranges::contains(
+		return;
+	}
+	session().channelDifferences().synced(channel);
+	if (ranges::contains(
 			_activeChats,
 			channel,
 			[](const auto &pair) { return pair.second.peer; })) {
@@ -467,8 +505,24 @@ void Updates::stateDone(const MTPupdates_State &state) {
 }
 
 void Updates::differenceDone(const MTPupdates_Difference &result) {
+	session().updatesRecorder().record(result);
 	_failDifferenceTimeout = 1;
 
+	auto &catchUp = session().updatesCatchUp();
+	catchUp.received();
+	const auto feedMeasured = [&](const auto &d) {
+		const auto started = crl::now();
+		feedDifference(
+			d.vusers(),
+			d.vchats(),
+			d.vnew_messages(),
+			d.vother_updates());
+		catchUp.applied(
+			d.vnew_messages().v.size(),
+			d.vother_updates().v.size(),
+			crl::now() - started);
+	};
+
 	switch (result.type()) {
 	case mtpc_updates_differenceEmpty: {
 		auto &d = result.c_updates_differenceEmpty();
@@ -478,29 +532,66 @@ void Updates::differenceDone(const MTPupdates_Difference &result) {
 		_noUpdatesTimer.callOnce(kNoUpdatesTimeout);
 
 		_ptsWaiter.setRequesting(false);
+		catchUp.finished();
 	} break;
 	case mtpc_updates_differenceSlice: {
 		auto &d = result.c_updates_differenceSlice();
-		feedDifference(d.vusers(), d.vchats(), d.vnew_messages(), d.vother_updates());
-
 		auto &s = d.vintermediate_state().c_updates_state();
-		setState(s.vpts().v, s.vdate().v, s.vqts().v, s.vseq().v);
 
-		_ptsWaiter.setRequesting(false);
+		// Applying the slice may start _byMinChannelTimer and hold the
+		// date back, so the next request is sent before applying it only
+		// if the date stays the same anyway.
+		const auto keepsDate = (DifferenceDate(
+			_updatesDate,
+			s.vdate().v,
+			_byMinChannelTimer.isActive()) == _updatesDate);
+		if (!catchUp.pipelined() || !keepsDate) {
+			feedMeasured(d);
+
+			setState(s.vpts().v, s.vdate().v, s.vqts().v, s.vseq().v);
+
+			_ptsWaiter.setRequesting(false);
+
+			MTP_LOG(0, ("getDifference "
+				"{ good - after a slice of difference was received }%1"
+				).arg(_session->mtp().isTestMode() ? " TESTMODE" : ""));
+			getDifference();
+			break;
+		}
 
+		// The intermediate state is all the next request needs, so it is
+		// sent before this slice is applied. The answer can't be handled
+		// before we return here, so the slices are still applied in order.
 		MTP_LOG(0, ("getDifference "
-			"{ good - after a slice of difference was received }%1"
+			"{ good - pipelined after a slice of difference was received }%1"
 			).arg(_session->mtp().isTestMode() ? " TESTMODE" : ""));
-		getDifference();
+		RequestDifference(
+			_session,
+			s.vpts().v,
+			_updatesDate,
+			std::max(_updatesQts, s.vqts().v),
+			[=](const MTPupdates_Difference &result) {
+				differenceDone(result);
+			},
+			[=](const MTP::Error &error) {
+				differenceFail(error);
+			});
+
+		feedMeasured(d);
+
+		// Still requesting, the next slice is on its way.
+		setState(s.vpts().v, s.vdate().v, s.vqts().v, s.vseq().v);
 	} break;
 	case mtpc_updates_difference: {
 		auto &d = result.c_updates_difference();
-		feedDifference(d.vusers(), d.vchats(), d.vnew_messages(), d.vother_updates());
+		feedMeasured(d);
 
 		stateDone(d.vstate());
+		catchUp.finished();
 	} break;
 	case mtpc_updates_differenceTooLong: {
 		LOG(("API Error: updates.differenceTooLong is not supported by Telegram Desktop!"));
+		catchUp.finished();
 	} break;
 	};
 }
@@ -674,7 +765,7 @@ void Updates::getDifference() {
 		return;
 	}
 
-	_bySeqUpdates.clear();
+	session().updatesSeqBuffer().clear();
 	_bySeqTimer.cancel();
 
 	_noUpdatesTimer.cancel();
@@ -682,19 +773,17 @@ void Updates::getDifference() {
 
 	_ptsWaiter.setRequesting(true);
 
-	api().request(MTPupdates_GetDifference(
-		MTP_flags(0),
-		MTP_int(_ptsWaiter.current()),
-		MTPint(), // pts_limit
-		MTPint(), // pts_total_limit
-		MTP_int(_updatesDate),
-		MTP_int(_updatesQts),
-		MTPint() // qts_limit
-	)).done([=](const MTPupdates_Difference &result) {
-		differenceDone(result);
-	}).fail([=](const MTP::Error &error) {
-		differenceFail(error);
-	}).send();
+	RequestDifference(
+		_session,
+		_ptsWaiter.current(),
+		_updatesDate,
+		_updatesQts,
+		[=](const MTPupdates_Difference &result) {
+			differenceDone(result);
+		},
+		[=](const MTP::Error &error) {
+			differenceFail(error);
+		});
 }
 
 void Updates::getChannelDifference(
@@ -719,17 +808,22 @@ void Updates::getChannelDifference(
 			flags = 0; // No force flag when requesting for short poll.
 		}
 	}
-	api().request(MTPupdates_GetChannelDifference(
-		MTP_flags(flags),
-		channel->inputChannel,
-		filter,
-		MTP_int(channel->pts()),
-		MTP_int(kChannelGetDifferenceLimit)
-	)).done([=](const MTPupdates_ChannelDifference &result) {
-		channelDifferenceDone(channel, result);
-	}).fail([=](const MTP::Error &error) {
-		channelDifferenceFail(channel, error);
-	}).send();
+	using Kind = ChannelDifferences::Kind;
+	session().channelDifferences().enqueue(channel, Kind::Regular, [=] {
+		api().request(MTPupdates_GetChannelDifference(
+			MTP_flags(flags),
+			channel->inputChannel,
+			filter,
+			MTP_int(channel->pts()),
+			MTP_int(kChannelGetDifferenceLimit)
+		)).done([=](const MTPupdates_ChannelDifference &result) {
+			session().channelDifferences().finished(channel, Kind::Regular);
+			channelDifferenceDone(channel, result);
+		}).fail([=](const MTP::Error &error) {
+			session().channelDifferences().finished(channel, Kind::Regular);
+			channelDifferenceFail(channel, error);
+		}).send();
+	});
 }
 
 void Updates::sendPing() {
@@ -758,6 +852,9 @@ void Updates::requestChannelRangeDifference(not_null<History*> history) {
 	if (const auto requestId = _rangeDifferenceRequests.take(channel)) {
 		api().request(*requestId).cancel();
 	}
+	session().channelDifferences().cancel(
+		channel,
+		ChannelDifferences::Kind::Range);
 	const auto range = history->rangeForDifferenceRequest();
 	if (!(range.from < range.till) || !channel->pts()) {
 		return;
@@ -782,19 +879,24 @@ void Updates::channelRangeDifferenceSend(
 		MTP_vector<MTPMessageRange>(1, MTP_messageRange(
 			MTP_int(range.from),
 			MTP_int(range.till - 1))));
-	const auto requestId = api().request(MTPupdates_GetChannelDifference(
-		MTP_flags(MTPupdates_GetChannelDifference::Flag::f_force),
-		channel->inputChannel,
-		filter,
-		MTP_int(pts),
-		MTP_int(limit)
-	)).done([=](const MTPupdates_ChannelDifference &result) {
-		_rangeDifferenceRequests.remove(channel);
-		channelRangeDifferenceDone(channel, range, result);
-	}).fail([=] {
-		_rangeDifferenceRequests.remove(channel);
-	}).send();
-	_rangeDifferenceRequests.emplace(channel, requestId);
+	using Kind = ChannelDifferences::Kind;
+	session().channelDifferences().enqueue(channel, Kind::Range, [=] {
+		const auto requestId = api().request(MTPupdates_GetChannelDifference(
+			MTP_flags(MTPupdates_GetChannelDifference::Flag::f_force),
+			channel->inputChannel,
+			filter,
+			MTP_int(pts),
+			MTP_int(limit)
+		)).done([=](const MTPupdates_ChannelDifference &result) {
+			_rangeDifferenceRequests.remove(channel);
+			session().channelDifferences().finished(channel, Kind::Range);
+			channelRangeDifferenceDone(channel, range, result);
+		}).fail([=] {
+			_rangeDifferenceRequests.remove(channel);
+			session().channelDifferences().finished(channel, Kind::Range);
+		}).send();
+		_rangeDifferenceRequests.emplace(channel, requestId);
+	});
 }
 
 void Updates::channelRangeDifferenceDone(
@@ -853,6 +955,7 @@ void Updates::mtpNewSessionCreated() {
 }
 
 void Updates::mtpUpdateReceived(const MTPUpdates &updates) {
+	session().updatesRecorder().record(updates);
 	Core::App().checkAutoLock();
 	_lastUpdateTime = crl::now();
 	_noUpdatesTimer.callOnce(kNoUpdatesTimeout);
@@ -1371,15 +1474,21 @@ void Updates::applyUpdates(
 				return;
 			}
 			if (d.vseq().v > _updatesSeq + 1) {
-				_bySeqUpdates.emplace(d.vseq().v, updates);
-				_bySeqTimer.callOnce(PtsWaiter::kWaitForSkippedTimeout);
+				auto &buffer = session().updatesSeqBuffer();
+				if (!buffer.push(d.vseq().v, _updatesSeq, updates)) {
+					getDifference();
+				} else if (!_bySeqTimer.isActive()) {
+					_bySeqTimer.callOnce(PtsWaiter::kWaitForSkippedTimeout);
+				}
 				return;
 			}
 		}
 
-		session().data().processUsers(d.vusers());
-		session().data().processChats(d.vchats());
-		feedUpdateVector(d.vupdates());
+		if (!session().updatesDispatcher().dropAll(d.vupdates())) {
+			session().data().processUsers(d.vusers());
+			session().data().processChats(d.vchats());
+			feedUpdateVector(d.vupdates());
+		}
 
 		setState(0, d.vdate().v, _updatesQts, d.vseq().v);
 	} break;
@@ -1391,22 +1500,30 @@ void Updates::applyUpdates(
 				return;
 			}
 			if (d.vseq_start().v > _updatesSeq + 1) {
-				_bySeqUpdates.emplace(d.vseq_start().v, updates);
-				_bySeqTimer.callOnce(PtsWaiter::kWaitForSkippedTimeout);
+				auto &buffer = session().updatesSeqBuffer();
+				if (!buffer.push(d.vseq_start().v, _updatesSeq, updates)) {
+					getDifference();
+				} else if (!_bySeqTimer.isActive()) {
+					_bySeqTimer.callOnce(PtsWaiter::kWaitForSkippedTimeout);
+				}
 				return;
 			}
 		}
 
-		session().data().processUsers(d.vusers());
-		session().data().processChats(d.vchats());
-		feedUpdateVector(d.vupdates());
+		if (!session().updatesDispatcher().dropAll(d.vupdates())) {
+			session().data().processUsers(d.vusers());
+			session().data().processChats(d.vchats());
+			feedUpdateVector(d.vupdates());
+		}
 
 		setState(0, d.vdate().v, _updatesQts, d.vseq().v);
 	} break;
 
 	case mtpc_updateShort: {
 		auto &d = updates.c_updateShort();
-		feedUpdate(d.vupdate());
+		session().updatesDispatcher().dispatch(d.vupdate(), [&] {
+			feedUpdate(d.vupdate());
+		});
 
 		setState(0, d.vdate().v, _updatesQts, _updatesSeq);
 	} break;
@@ -1673,26 +1790,7 @@ void Updates::feedUpdate(const MTPUpdate &update) {
 
 	case mtpc_updateMessageReactions: {
 		const auto &d = update.c_updateMessageReactions();
-		const auto peer = peerFromMTP(d.vpeer());
-		if (const auto history = session().data().historyLoaded(peer)) {
-			const auto item = session().data().message(
-				peer,
-				d.vmsg_id().v);
-			if (item) {
-				item->updateReactions(&d.vreactions());
-			} else {
-				const auto hasUnreadReaction = session().kgMode()
-					? session().api().unreadThings().hasUnreadReactionFromNonBlockedUser(d.vreactions()) // kg
-					: Data::Reactions::HasUnread(d.vreactions());
-				if (hasUnreadReaction || history->unreadReactions().has()) {
-					// The unread reactions count could change.
-					history->owner().histories().requestDialogEntry(history);
-				}
-				if (hasUnreadReaction) {
-					history->unreadReactions().checkAdd(d.vmsg_id().v);
-				}
-			}
-		}
+		session().data().reactions().applyUpdate(d);
 	} break;
 
 	case mtpc_updateMessageExtendedMedia: {
@@ -1855,8 +1953,7 @@ void Updates::feedUpdate(const MTPUpdate &update) {
 
 	case mtpc_updateUserTyping: {
 		auto &d = update.c_updateUserTyping();
-		if (_session->kgModeAndUserIsBlocked(peerFromUser(d.vuser_id()).value)) return; // kg
-		handleSendActionUpdate(
+		session().updatesDispatcher().typing().push(
 			peerFromUser(d.vuser_id()),
 			0,
 			peerFromUser(d.vuser_id()),
@@ -1865,8 +1962,7 @@ void Updates::feedUpdate(const MTPUpdate &update) {
 
 	case mtpc_updateChatUserTyping: {
 		auto &d = update.c_updateChatUserTyping();
-		if (_session->kgModeAndUserIsBlocked(peerFromMTP(d.vfrom_id()).value)) return; // kg
-		handleSendActionUpdate(
+		session().updatesDispatcher().typing().push(
 			peerFromChat(d.vchat_id()),
 			0,
 			peerFromMTP(d.vfrom_id()),
@@ -1875,8 +1971,7 @@ void Updates::feedUpdate(const MTPUpdate &update) {
 
 	case mtpc_updateChannelUserTyping: {
 		const auto &d = update.c_updateChannelUserTyping();
-		if (_session->kgModeAndUserIsBlocked(peerFromMTP(d.vfrom_id()).value)) return; // kg
-		handleSendActionUpdate(
+		session().updatesDispatcher().typing().push(
 			peerFromChannel(d.vchannel_id()),
 			d.vtop_msg_id().value_or_empty(),
 			peerFromMTP(d.vfrom_id()),
@@ -0,0 +1,70 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "api/api_updates_catch_up.h"
+
+namespace Api {
+
+void UpdatesCatchUp::requested() {
+	const auto now = crl::now();
+	if (!active()) {
+		_progress = Progress{ .started = now };
+	}
+	_requesting = true;
+	if (!_applying) {
+		_waitStarted = now;
+	}
+}
+
+void UpdatesCatchUp::received() {
+	if (!active()) {
+		return;
+	}
+	if (_waitStarted) {
+		_progress.waitDuration += crl::now() - _waitStarted;
+		_waitStarted = 0;
+	}
+	_requesting = false;
+	_applying = true;
+}
+
+void UpdatesCatchUp::applied(int messages, int updates, crl::time duration) {
+	if (!active()) {
+		return;
+	}
+	_applying = false;
+	++_progress.slices;
+	_progress.messages += messages;
+	_progress.updates += updates;
+	_progress.applyDuration += duration;
+	if (_requesting) {
+		// The next slice is on its way already.
+		_waitStarted = crl::now();
+	}
+	_progressChanges.fire_copy(_progress);
+}
+
+void UpdatesCatchUp::finished() {
+	if (!active()) {
+		return;
+	}
+	_requesting = _applying = false;
+	_waitStarted = 0;
+	_progress.finished = true;
+	LOG(("Updates Catch-up: %1 slices, %2 messages, %3 updates "
+		"in %4 ms, %5 ms applying, %6 ms waiting%7."
+		).arg(_progress.slices
+		).arg(_progress.messages
+		).arg(_progress.updates
+		).arg(crl::now() - _progress.started
+		).arg(_progress.applyDuration
+		).arg(_progress.waitDuration
+		).arg(_pipelined ? u", pipelined"_q : QString()));
+	_progressChanges.fire_copy(_progress);
+}
+
+} // namespace Api
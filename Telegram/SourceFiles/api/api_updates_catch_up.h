@@ -0,0 +1,61 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+namespace Api {
+
+// Progress of a getDifference catch-up, from the first request till
+// a final difference (or an empty one) is applied.
+//
+// With pipelining the next slice is requested as soon as the
+// intermediate state of the current one is known, before it is applied.
+class UpdatesCatchUp final {
+public:
+	struct Progress {
+		int slices = 0;
+		int64 messages = 0;
+		int64 updates = 0;
+		crl::time started = 0;
+		crl::time applyDuration = 0;
+		crl::time waitDuration = 0; // Without any slice being applied.
+		bool finished = false;
+	};
+
+	[[nodiscard]] bool pipelined() const {
+		return _pipelined;
+	}
+	void setPipelined(bool pipelined) {
+		_pipelined = pipelined;
+	}
+
+	void requested();
+	void received();
+	void applied(int messages, int updates, crl::time duration);
+	void finished();
+
+	[[nodiscard]] bool active() const {
+		return _progress.started && !_progress.finished;
+	}
+	[[nodiscard]] const Progress &current() const {
+		return _progress;
+	}
+	[[nodiscard]] rpl::producer<Progress> progress() const {
+		return _progressChanges.events();
+	}
+
+private:
+	bool _pipelined = true;
+	bool _requesting = false;
+	bool _applying = false;
+	Progress _progress;
+	crl::time _waitStarted = 0;
+	rpl::event_stream<Progress> _progressChanges;
+
+};
+
+} // namespace Api
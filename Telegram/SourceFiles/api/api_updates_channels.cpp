@@ -0,0 +1,168 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "api/api_updates_channels.h"
+
+#include "data/data_channel.h"
+#include "data/data_session.h"
+#include "history/history.h"
+#include "main/main_session.h"
+#include "window/window_session_controller.h"
+
+namespace Api {
+namespace {
+
+// Rows are repainted on any chat list change, a row painted this recently
+// is treated as being on the screen.
+constexpr auto kVisibleRowTimeout = crl::time(1000);
+
+constexpr auto kLogStatsEach = 100;
+
+} // namespace
+
+ChannelDifferences::ChannelDifferences(not_null<Main::Session*> session)
+: _session(session) {
+}
+
+void ChannelDifferences::enqueue(
+		not_null<ChannelData*> channel,
+		Kind kind,
+		Fn<void()> send) {
+	const auto now = crl::now();
+	if (kind == Kind::Regular) {
+		_staleSince.emplace(channel, now);
+	}
+	_queue.push_back({
+		.key = { channel.get(), kind },
+		.send = std::move(send),
+		.enqueued = now,
+	});
+	_stats.queued = int(_queue.size());
+	accumulate_max(_stats.queuedPeak, _stats.queued);
+	pump();
+}
+
+void ChannelDifferences::finished(not_null<ChannelData*> channel, Kind kind) {
+	if (_running.remove(Key{ channel.get(), kind })) {
+		_stats.running = int(_running.size());
+		pump();
+	}
+}
+
+void ChannelDifferences::cancel(not_null<ChannelData*> channel, Kind kind) {
+	const auto key = Key{ channel.get(), kind };
+	const auto removed = ranges::remove(_queue, key, &Queued::key);
+	if (removed != end(_queue)) {
+		_queue.erase(removed, end(_queue));
+		_stats.queued = int(_queue.size());
+	}
+	finished(channel, kind);
+}
+
+void ChannelDifferences::synced(not_null<ChannelData*> channel) {
+	if (const auto since = _staleSince.take(channel)) {
+		accumulate_max(_stats.stalenessMax, crl::now() - *since);
+	}
+}
+
+crl::time ChannelDifferences::staleness(
+		not_null<ChannelData*> channel) const {
+	const auto i = _staleSince.find(channel);
+	return (i != end(_staleSince)) ? (crl::now() - i->second) : 0;
+}
+
+crl::time ChannelDifferences::maxStaleness() const {
+	if (_staleSince.empty()) {
+		return 0;
+	}
+	const auto oldest = ranges::min(
+		_staleSince,
+		ranges::less(),
+		[](const auto &pair) { return pair.second; });
+	return crl::now() - oldest.second;
+}
+
+auto ChannelDifferences::computePriority(
+		not_null<ChannelData*> channel) const -> Priority {
+	for (const auto &window : _session->windows()) {
+		if (window->activeChatCurrent().peer() == channel.get()) {
+			return Priority::Open;
+		}
+	}
+	const auto history = _session->data().historyLoaded(channel);
+	if (!history) {
+		return Priority::Background;
+	}
+	const auto painted = history->chatListPaintedAt();
+	if (painted && crl::now() - painted < kVisibleRowTimeout) {
+		return Priority::Visible;
+	} else if (history->isPinnedDialog(FilterId())) {
+		return Priority::Pinned;
+	}
+	return Priority::Background;
+}
+
+void ChannelDifferences::pump() {
+	if (_pumping) {
+		return;
+	}
+	_pumping = true;
+	while (!_queue.empty()) {
+		auto best = end(_queue);
+		auto bestPriority = Priority::Background;
+		for (auto i = begin(_queue); i != end(_queue); ++i) {
+			const auto priority = computePriority(i->key.channel);
+			if (best == end(_queue) || priority < bestPriority) {
+				best = i;
+				bestPriority = priority;
+				if (priority == Priority::Open) {
+					break;
+				}
+			}
+		}
+		if (_running.size() >= kMaxRunning
+			&& bestPriority != Priority::Open) {
+			break;
+		}
+		auto entry = std::move(*best);
+		_queue.erase(best);
+		_running.emplace(entry.key);
+
+		const auto wait = crl::now() - entry.enqueued;
+		_stats.queued = int(_queue.size());
+		_stats.running = int(_running.size());
+		++_stats.sent;
+		++_stats.sentByPriority[int(bestPriority)];
+		_stats.waitTotal += wait;
+		accumulate_max(_stats.waitMax, wait);
+
+		entry.send();
+	}
+	_pumping = false;
+	if (_queue.empty() && _stats.sent - _loggedSent >= kLogStatsEach) {
+		_loggedSent = _stats.sent;
+		logStats();
+	}
+}
+
+void ChannelDifferences::logStats() const {
+	DEBUG_LOG(("Channel Differences: %1 sent "
+		"(open %2, visible %3, pinned %4, background %5), "
+		"queue peak %6, wait %7 ms average %8 ms max, "
+		"staleness %9 ms max."
+		).arg(_stats.sent
+		).arg(_stats.sentByPriority[int(Priority::Open)]
+		).arg(_stats.sentByPriority[int(Priority::Visible)]
+		).arg(_stats.sentByPriority[int(Priority::Pinned)]
+		).arg(_stats.sentByPriority[int(Priority::Background)]
+		).arg(_stats.queuedPeak
+		).arg(_stats.sent ? (_stats.waitTotal / _stats.sent) : 0
+		).arg(_stats.waitMax
+		).arg(std::max(_stats.stalenessMax, maxStaleness())));
+}
+
+} // namespace Api
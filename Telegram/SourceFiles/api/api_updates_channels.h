@@ -0,0 +1,104 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+class ChannelData;
+
+namespace Main {
+class Session;
+} // namespace Main
+
+namespace Api {
+
+// All getChannelDifference requests go through this queue, so that after
+// a reconnect hundreds of channels don't compete for the connection.
+//
+// At most kMaxRunning requests are sent at once. The priority of each
+// queued request is computed when a slot is free: the chat opened in any
+// window goes first (even over the limit), then the chat list rows that
+// were painted recently, then the pinned chats, then all the rest.
+class ChannelDifferences final {
+public:
+	enum class Kind : uchar {
+		Regular,
+		Range, // Validating a loaded history part after a "too long".
+	};
+	enum class Priority : uchar {
+		Open,
+		Visible,
+		Pinned,
+		Background,
+	};
+	static constexpr auto kPriorityCount = 4;
+
+	struct Stats {
+		int queued = 0;
+		int running = 0;
+		int queuedPeak = 0;
+		int64 sent = 0;
+		std::array<int64, kPriorityCount> sentByPriority = {};
+		crl::time waitTotal = 0;
+		crl::time waitMax = 0;
+		crl::time stalenessMax = 0; // Till the final difference is applied.
+	};
+
+	explicit ChannelDifferences(not_null<Main::Session*> session);
+
+	// The send callback is called once, maybe right away. After it the
+	// request must end with finished() or cancel() for the slot to free.
+	void enqueue(
+		not_null<ChannelData*> channel,
+		Kind kind,
+		Fn<void()> send);
+	void finished(not_null<ChannelData*> channel, Kind kind);
+	void cancel(not_null<ChannelData*> channel, Kind kind);
+
+	// The final difference was applied, the channel is up to date.
+	void synced(not_null<ChannelData*> channel);
+
+	// Time since the channel is known to have missed updates,
+	// zero when it is up to date.
+	[[nodiscard]] crl::time staleness(not_null<ChannelData*> channel) const;
+	[[nodiscard]] crl::time maxStaleness() const;
+
+	[[nodiscard]] const Stats &stats() const {
+		return _stats;
+	}
+
+private:
+	static constexpr auto kMaxRunning = 4;
+
+	struct Key {
+		ChannelData *channel = nullptr;
+		Kind kind = Kind::Regular;
+
+		friend inline auto operator<=>(Key, Key) = default;
+	};
+	struct Queued {
+		Key key;
+		Fn<void()> send;
+		crl::time enqueued = 0;
+	};
+
+	[[nodiscard]] Priority computePriority(
+		not_null<ChannelData*> channel) const;
+	void pump();
+	void logStats() const;
+
+	const not_null<Main::Session*> _session;
+
+	std::vector<Queued> _queue;
+	base::flat_set<Key> _running;
+	base::flat_map<not_null<ChannelData*>, crl::time> _staleSince;
+	bool _pumping = false;
+	Stats _stats;
+	int64 _loggedSent = 0;
+
+};
+
+} // namespace Api
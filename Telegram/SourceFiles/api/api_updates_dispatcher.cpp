@@ -0,0 +1,214 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "api/api_updates_dispatcher.h"
+
+#include "main/main_session.h"
+
+namespace Api {
+namespace {
+
+using PeerGetter = PeerId(*)(const MTPUpdate &update);
+
+// Only stateless updates are in the table: applying a later one first
+// can't leave stale data, unlike reactions, polls or views counters.
+// Updates not in the table are ordered: they keep their place in the
+// container and are never dropped.
+struct UpdateTraits {
+	mtpTypeId type = 0;
+	PeerGetter history = nullptr;
+	PeerGetter author = nullptr; // Updates with author may be dropped.
+};
+
+template <std::size_t Size>
+[[nodiscard]] constexpr auto SortedTraits(
+		std::array<UpdateTraits, Size> list) {
+	std::sort(begin(list), end(list), [](
+			const UpdateTraits &a,
+			const UpdateTraits &b) {
+		return a.type < b.type;
+	});
+	return list;
+}
+
+constexpr auto kUpdateTraits = SortedTraits(std::array{
+	UpdateTraits{
+		.type = mtpc_updateUserTyping,
+		.history = [](const MTPUpdate &update) {
+			return peerFromUser(update.c_updateUserTyping().vuser_id());
+		},
+		.author = [](const MTPUpdate &update) {
+			return peerFromUser(update.c_updateUserTyping().vuser_id());
+		},
+	},
+	UpdateTraits{
+		.type = mtpc_updateChatUserTyping,
+		.history = [](const MTPUpdate &update) {
+			return peerFromChat(update.c_updateChatUserTyping().vchat_id());
+		},
+		.author = [](const MTPUpdate &update) {
+			return peerFromMTP(update.c_updateChatUserTyping().vfrom_id());
+		},
+	},
+	UpdateTraits{
+		.type = mtpc_updateChannelUserTyping,
+		.history = [](const MTPUpdate &update) {
+			const auto &data = update.c_updateChannelUserTyping();
+			return peerFromChannel(data.vchannel_id());
+		},
+		.author = [](const MTPUpdate &update) {
+			return peerFromMTP(update.c_updateChannelUserTyping().vfrom_id());
+		},
+	},
+	UpdateTraits{
+		.type = mtpc_updateUserStatus,
+		.history = [](const MTPUpdate &update) {
+			return peerFromUser(update.c_updateUserStatus().vuser_id());
+		},
+	},
+});
+
+struct HistoryAuthor {
+	PeerId history = 0;
+	PeerId author = 0;
+
+	friend inline auto operator<=>(HistoryAuthor, HistoryAuthor) = default;
+};
+
+// A new message ends the typing of its author, so it matters if it comes
+// before or after a typing update from the same author.
+[[nodiscard]] std::optional<HistoryAuthor> NewMessageAuthor(
+		const MTPUpdate &update) {
+	const auto message = [&]() -> const MTPMessage* {
+		switch (update.type()) {
+		case mtpc_updateNewMessage:
+			return &update.c_updateNewMessage().vmessage();
+		case mtpc_updateNewChannelMessage:
+			return &update.c_updateNewChannelMessage().vmessage();
+		}
+		return nullptr;
+	}();
+	if (!message || message->type() != mtpc_message) {
+		return std::nullopt;
+	}
+	const auto &data = message->c_message();
+	const auto history = peerFromMTP(data.vpeer_id());
+	const auto from = data.vfrom_id();
+	return HistoryAuthor{ history, from ? peerFromMTP(*from) : history };
+}
+
+[[nodiscard]] const UpdateTraits *LookupTraits(mtpTypeId type) {
+	const auto i = std::lower_bound(
+		begin(kUpdateTraits),
+		end(kUpdateTraits),
+		type,
+		[](const UpdateTraits &traits, mtpTypeId type) {
+			return traits.type < type;
+		});
+	return (i != end(kUpdateTraits) && i->type == type) ? &*i : nullptr;
+}
+
+} // namespace
+
+UpdatesDispatcher::UpdatesDispatcher(not_null<Main::Session*> session)
+: _session(session) {
+}
+
+bool UpdatesDispatcher::drop(const MTPUpdate &update) const {
+	if (!_session->kgMode()) { // kg
+		return false;
+	}
+	const auto traits = LookupTraits(update.type());
+	return traits
+		&& traits->author
+		&& _session->userIsBlocked(traits->author(update).value);
+}
+
+bool UpdatesDispatcher::dropAll(const MTPVector<MTPUpdate> &updates) {
+	const auto &list = updates.v;
+	if (list.isEmpty()
+		|| !ranges::all_of(list, [&](const MTPUpdate &update) {
+			return drop(update);
+		})) {
+		return false;
+	}
+	for (const auto &update : list) {
+		auto &counter = _counters[update.type()];
+		++counter.count;
+		++counter.dropped;
+	}
+	return true;
+}
+
+std::vector<not_null<const MTPUpdate*>> UpdatesDispatcher::schedule(
+		const QVector<MTPUpdate> &list) const {
+	struct Free {
+		PeerId history = 0;
+		not_null<const MTPUpdate*> update;
+	};
+	// Free updates are applied after all the ordered ones, so a typing
+	// that came before a message of its author would show up again.
+	// Such typing updates are skipped, the message ends them anyway.
+	auto lastMessageIndex = base::flat_map<HistoryAuthor, int>();
+	for (auto index = 0, count = int(list.size()); index != count; ++index) {
+		if (const auto key = NewMessageAuthor(list[index])) {
+			lastMessageIndex[*key] = index;
+		}
+	}
+	const auto endedByMessage = [&](
+			const UpdateTraits &traits,
+			const MTPUpdate &update,
+			int index) {
+		if (lastMessageIndex.empty() || !traits.author) {
+			return false;
+		}
+		const auto i = lastMessageIndex.find(HistoryAuthor{
+			traits.history(update),
+			traits.author(update),
+		});
+		return (i != end(lastMessageIndex)) && (i->second > index);
+	};
+
+	auto result = std::vector<not_null<const MTPUpdate*>>();
+	auto free = std::vector<Free>();
+	result.reserve(list.size());
+	for (auto index = 0, count = int(list.size()); index != count; ++index) {
+		const auto &update = list[index];
+		if (const auto traits = LookupTraits(update.type())) {
+			if (!endedByMessage(*traits, update, index)) {
+				free.push_back({ traits->history(update), &update });
+			}
+		} else {
+			result.push_back(&update);
+		}
+	}
+	ranges::stable_sort(free, ranges::less(), &Free::history);
+	for (const auto &entry : free) {
+		result.push_back(entry.update);
+	}
+	return result;
+}
+
+void UpdatesDispatcher::logCounters() const {
+	auto list = std::vector<std::pair<mtpTypeId, Counter>>(
+		begin(_counters),
+		end(_counters));
+	ranges::sort(list, ranges::greater(), [](const auto &pair) {
+		return pair.second.duration;
+	});
+	auto lines = QStringList();
+	for (const auto &[type, counter] : list) {
+		lines.push_back(u"0x%1: %2 (%3 dropped) in %4 mcs"_q
+			.arg(uint32(type), 8, 16, QChar('0'))
+			.arg(counter.count)
+			.arg(counter.dropped)
+			.arg(counter.duration));
+	}
+	DEBUG_LOG(("Updates Dispatcher: %1").arg(lines.join(", ")));
+}
+
+} // namespace Api
@@ -0,0 +1,89 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "api/api_updates_typing.h"
+
+namespace Main {
+class Session;
+} // namespace Main
+
+namespace Api {
+
+// First stage of Api::Updates::feedUpdate.
+//
+// Every update is classified by its constructor through a compile-time
+// table, see UpdateTraits in the .cpp. The table tells which updates may
+// be applied out of order and how to find their history and author, so
+// updates of blocked authors are dropped before the users and chats of
+// their container are processed, and free updates (typing and statuses)
+// of the same history are applied together, after all the ordered ones.
+class UpdatesDispatcher final {
+public:
+	struct Counter {
+		int64 count = 0;
+		int64 dropped = 0;
+		crl::profile_time duration = 0; // Microseconds in feedUpdate.
+	};
+
+	explicit UpdatesDispatcher(not_null<Main::Session*> session);
+
+	[[nodiscard]] TypingCoalescer &typing() {
+		return _typing;
+	}
+
+	// If all updates are dropped their users and chats are not needed.
+	[[nodiscard]] bool dropAll(const MTPVector<MTPUpdate> &updates);
+
+	// Ordered updates in their original order, then the free ones
+	// grouped by history. Typing of an author that is followed by a new
+	// message of this author in the same list is skipped.
+	[[nodiscard]] std::vector<not_null<const MTPUpdate*>> schedule(
+		const QVector<MTPUpdate> &list) const;
+
+	template <typename Handler>
+	void dispatch(const MTPUpdate &update, Handler &&handler) {
+		const auto type = update.type();
+		if (drop(update)) {
+			auto &counter = _counters[type];
+			++counter.count;
+			++counter.dropped;
+			return;
+		}
+		const auto started = crl::profile();
+		handler();
+
+		// The handler may dispatch more, don't keep references over it.
+		auto &counter = _counters[type];
+		++counter.count;
+		counter.duration += crl::profile() - started;
+		if (!(++_dispatched % kLogCountersEach)) {
+			logCounters();
+		}
+	}
+
+	[[nodiscard]] auto counters() const
+		-> const base::flat_map<mtpTypeId, Counter> & {
+		return _counters;
+	}
+	void logCounters() const;
+
+private:
+	static constexpr auto kLogCountersEach = 10'000;
+
+	[[nodiscard]] bool drop(const MTPUpdate &update) const;
+
+	const not_null<Main::Session*> _session;
+	TypingCoalescer _typing;
+
+	base::flat_map<mtpTypeId, Counter> _counters;
+	int64 _dispatched = 0;
+
+};
+
+} // namespace Api
@@ -0,0 +1,405 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "api/api_updates_recorder.h"
+
+#include "api/api_updates.h"
+#include "data/data_histories.h"
+#include "data/data_session.h"
+#include "main/main_session.h"
+
+#include <QtCore/QDataStream>
+#include <QtCore/QFile>
+
+#include <bit>
+
+namespace Api {
+namespace {
+
+constexpr auto kFileMagic = quint32(0x52554454); // TDUR
+constexpr auto kRecordVariable = "TDESKTOP_UPDATES_RECORD";
+constexpr auto kReplayVariable = "TDESKTOP_UPDATES_REPLAY";
+constexpr auto kFileVersion = quint32(1);
+
+// Updates with pts, they are fed through applyUpdateNoPtsCheck().
+// Must match the list of types handled there.
+[[nodiscard]] bool IsPtsUpdate(mtpTypeId type) {
+	switch (type) {
+	case mtpc_updateNewMessage:
+	case mtpc_updateReadMessagesContents:
+	case mtpc_updateReadHistoryInbox:
+	case mtpc_updateReadHistoryOutbox:
+	case mtpc_updateWebPage:
+	case mtpc_updateFolderPeers:
+	case mtpc_updateDeleteMessages:
+	case mtpc_updateNewChannelMessage:
+	case mtpc_updateEditChannelMessage:
+	case mtpc_updatePinnedChannelMessages:
+	case mtpc_updateEditMessage:
+	case mtpc_updateChannelWebPage:
+	case mtpc_updateDeleteChannelMessages:
+	case mtpc_updatePinnedMessages:
+		return true;
+	}
+	return false;
+}
+
+// Updates that request the server or refer to the recording session.
+[[nodiscard]] bool IsLiveOnlyUpdate(mtpTypeId type) {
+	return (type == mtpc_updateChannelTooLong)
+		|| (type == mtpc_updateMessageID);
+}
+
+[[nodiscard]] int LatencyBucket(crl::profile_time duration) {
+	return std::min(
+		int(std::bit_width(uint64(std::max(duration, crl::profile_time())))),
+		UpdatesReplayStats::kLatencyBuckets - 1);
+}
+
+template <typename MTPType>
+[[nodiscard]] std::optional<MTPType> ReadFrame(const QByteArray &bytes) {
+	if (bytes.size() % sizeof(mtpPrime)) {
+		return std::nullopt;
+	}
+	auto from = reinterpret_cast<const mtpPrime*>(bytes.constData());
+	const auto till = from + (bytes.size() / sizeof(mtpPrime));
+	auto result = MTPType();
+	if (!result.read(from, till) || from != till) {
+		return std::nullopt;
+	}
+	return result;
+}
+
+} // namespace
+
+UpdatesRecorder::UpdatesRecorder() = default;
+
+UpdatesRecorder::~UpdatesRecorder() {
+	stop();
+}
+
+bool UpdatesRecorder::start(const QString &path) {
+	stop();
+
+	_file = std::make_unique<QFile>(path);
+	if (!_file->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		LOG(("Updates Recorder: Could not open '%1' for writing."
+			).arg(path));
+		_file = nullptr;
+		return false;
+	}
+	_stream = std::make_unique<QDataStream>(_file.get());
+	_stream->setVersion(QDataStream::Qt_5_1);
+	*_stream << kFileMagic << kFileVersion;
+	_started = crl::now();
+	_frames = 0;
+	LOG(("Updates Recorder: Started writing to '%1'.").arg(path));
+	return true;
+}
+
+void UpdatesRecorder::stop() {
+	if (!_stream) {
+		return;
+	}
+	_stream = nullptr;
+	_file->close();
+	_file = nullptr;
+	LOG(("Updates Recorder: Stopped, %1 frames written.").arg(_frames));
+}
+
+void UpdatesRecorder::record(const MTPUpdates &updates) {
+	write(UpdatesFrameType::Updates, updates);
+}
+
+void UpdatesRecorder::record(const MTPupdates_Difference &difference) {
+	write(UpdatesFrameType::Difference, difference);
+}
+
+void UpdatesRecorder::record(
+		const MTPupdates_ChannelDifference &difference) {
+	write(UpdatesFrameType::ChannelDifference, difference);
+}
+
+template <typename MTPType>
+void UpdatesRecorder::write(UpdatesFrameType type, const MTPType &data) {
+	if (!_stream) {
+		return;
+	}
+	auto buffer = mtpBuffer();
+	data.write(buffer);
+	*_stream
+		<< quint32(type)
+		<< qint64(crl::now() - _started)
+		<< QByteArray::fromRawData(
+			reinterpret_cast<const char*>(buffer.constData()),
+			buffer.size() * sizeof(mtpPrime));
+	if (_stream->status() != QDataStream::Ok) {
+		LOG(("Updates Recorder: Write failed."));
+		stop();
+		return;
+	}
+	++_frames;
+}
+
+double UpdatesReplayStats::updatesPerSecond() const {
+	return duration
+		? (updates * 1'000'000. / duration)
+		: 0.;
+}
+
+UpdatesReplay::UpdatesReplay(not_null<Main::Session*> session)
+: _session(session) {
+}
+
+std::optional<UpdatesReplayStats> UpdatesReplay::run(const QString &path) {
+	auto file = QFile(path);
+	if (!file.open(QIODevice::ReadOnly)) {
+		LOG(("Updates Replay: Could not open '%1'.").arg(path));
+		return std::nullopt;
+	}
+	auto stream = QDataStream(&file);
+	stream.setVersion(QDataStream::Qt_5_1);
+	auto magic = quint32();
+	auto version = quint32();
+	stream >> magic >> version;
+	if (magic != kFileMagic || version != kFileVersion) {
+		LOG(("Updates Replay: Bad file '%1'.").arg(path));
+		return std::nullopt;
+	}
+
+	const auto &histories = _session->data().histories();
+	const auto allocationsWas = histories.itemsAllocationStats();
+
+	_stats = UpdatesReplayStats();
+	auto firstDifference = qint64();
+	const auto started = crl::profile();
+	while (!stream.atEnd()) {
+		auto type = quint32();
+		auto received = qint64();
+		auto bytes = QByteArray();
+		stream >> type >> received >> bytes;
+		if (stream.status() != QDataStream::Ok) {
+			LOG(("Updates Replay: Truncated frame %1.").arg(_stats.frames));
+			break;
+		}
+		const auto parsed = [&] {
+			switch (UpdatesFrameType(type)) {
+			case UpdatesFrameType::Updates:
+				if (const auto data = ReadFrame<MTPUpdates>(bytes)) {
+					feed(*data);
+					return true;
+				}
+				return false;
+			case UpdatesFrameType::Difference:
+				if (const auto data = ReadFrame<MTPupdates_Difference>(
+						bytes)) {
+					if (!_stats.differenceFrames++) {
+						firstDifference = received;
+					}
+					_stats.differenceRecorded = received - firstDifference;
+					const auto started = crl::profile();
+					feed(*data);
+					_stats.differenceApply += crl::profile() - started;
+					return true;
+				}
+				return false;
+			case UpdatesFrameType::ChannelDifference:
+				if (const auto data = ReadFrame<
+						MTPupdates_ChannelDifference>(bytes)) {
+					feed(*data);
+					return true;
+				}
+				return false;
+			}
+			return false;
+		}();
+		if (!parsed) {
+			LOG(("Updates Replay: Bad frame %1.").arg(_stats.frames));
+			break;
+		}
+		++_stats.frames;
+	}
+	_stats.duration = crl::profile() - started;
+
+	const auto allocationsNow = histories.itemsAllocationStats();
+	_stats.itemAllocations = allocationsNow.allocations
+		- allocationsWas.allocations;
+	_stats.itemFrees = allocationsNow.frees - allocationsWas.frees;
+	return std::move(_stats);
+}
+
+void UpdatesReplay::feed(const MTPUpdates &updates) {
+	auto &owner = _session->data();
+	updates.match([&](const MTPDupdates &data) {
+		owner.processUsers(data.vusers());
+		owner.processChats(data.vchats());
+		for (const auto &update : data.vupdates().v) {
+			feedUpdate(update, data.vdate().v);
+		}
+	}, [&](const MTPDupdatesCombined &data) {
+		owner.processUsers(data.vusers());
+		owner.processChats(data.vchats());
+		for (const auto &update : data.vupdates().v) {
+			feedUpdate(update, data.vdate().v);
+		}
+	}, [&](const MTPDupdateShort &data) {
+		feedUpdate(data.vupdate(), data.vdate().v);
+	}, [&](const MTPDupdateShortMessage &) {
+		measure(updates.type(), [&] {
+			_session->updates().applyUpdatesNoPtsCheck(updates);
+		});
+	}, [&](const MTPDupdateShortChatMessage &) {
+		measure(updates.type(), [&] {
+			_session->updates().applyUpdatesNoPtsCheck(updates);
+		});
+	}, [&](const auto &) {
+		// updateShortSentMessage needs the local message being sent,
+		// updatesTooLong needs a live connection.
+		++_stats.skipped;
+	});
+	owner.sendHistoryChangeNotifications();
+}
+
+void UpdatesReplay::feed(const MTPupdates_Difference &difference) {
+	difference.match([&](const MTPDupdates_difference &data) {
+		feedDifference(
+			data.vusers(),
+			data.vchats(),
+			data.vnew_messages(),
+			data.vother_updates());
+	}, [&](const MTPDupdates_differenceSlice &data) {
+		feedDifference(
+			data.vusers(),
+			data.vchats(),
+			data.vnew_messages(),
+			data.vother_updates());
+	}, [&](const auto &) {
+		++_stats.skipped;
+	});
+}
+
+void UpdatesReplay::feed(const MTPupdates_ChannelDifference &difference) {
+	difference.match([&](const MTPDupdates_channelDifference &data) {
+		feedDifference(
+			data.vusers(),
+			data.vchats(),
+			data.vnew_messages(),
+			data.vother_updates());
+	}, [&](const auto &) {
+		++_stats.skipped;
+	});
+}
+
+void UpdatesReplay::feedDifference(
+		const MTPVector<MTPUser> &users,
+		const MTPVector<MTPChat> &chats,
+		const MTPVector<MTPMessage> &messages,
+		const MTPVector<MTPUpdate> &other) {
+	auto &owner = _session->data();
+	owner.processUsers(users);
+	owner.processChats(chats);
+
+	// New messages are fed one by one, as if they came in updates,
+	// so that they get into the per type latency statistics.
+	for (const auto &message : messages.v) {
+		const auto channel = peerIsChannel(PeerFromMessage(message));
+		feedUpdate(channel
+			? MTP_updateNewChannelMessage(message, MTP_int(0), MTP_int(0))
+			: MTP_updateNewMessage(message, MTP_int(0), MTP_int(0)),
+			TimeId());
+	}
+	for (const auto &update : other.v) {
+		feedUpdate(update, TimeId());
+	}
+	owner.sendHistoryChangeNotifications();
+}
+
+void UpdatesReplay::feedUpdate(const MTPUpdate &update, TimeId date) {
+	const auto type = update.type();
+	if (IsLiveOnlyUpdate(type)) {
+		++_stats.skipped;
+		return;
+	}
+	auto &updates = _session->updates();
+	if (IsPtsUpdate(type)) {
+		measure(type, [&] {
+			updates.applyUpdateNoPtsCheck(update);
+		});
+	} else {
+		const auto wrapped = MTP_updateShort(update, MTP_int(date));
+		measure(type, [&] {
+			updates.applyUpdates(wrapped);
+		});
+	}
+}
+
+template <typename Handler>
+void UpdatesReplay::measure(mtpTypeId type, Handler &&handler) {
+	const auto started = crl::profile();
+	handler();
+	const auto duration = crl::profile() - started;
+
+	auto &entry = _stats.types[type];
+	++entry.count;
+	entry.total += duration;
+	++entry.histogram[LatencyBucket(duration)];
+	++_stats.updates;
+}
+
+void UpdatesReplay::Log(const UpdatesReplayStats &stats) {
+	LOG(("Updates Replay: %1 frames, %2 updates (%3 skipped) in %4 mcs, "
+		"%5 updates per second, %6 items allocated, %7 freed."
+		).arg(stats.frames
+		).arg(stats.updates
+		).arg(stats.skipped
+		).arg(stats.duration
+		).arg(stats.updatesPerSecond(), 0, 'f', 1
+		).arg(stats.itemAllocations
+		).arg(stats.itemFrees));
+	if (stats.differenceFrames) {
+		LOG(("Updates Replay: %1 getDifference responses recorded "
+			"over %2 ms, applied in %3 mcs."
+			).arg(stats.differenceFrames
+			).arg(stats.differenceRecorded
+			).arg(stats.differenceApply));
+	}
+	for (const auto &[type, entry] : stats.types) {
+		auto histogram = QStringList();
+		for (auto i = 0; i != UpdatesReplayStats::kLatencyBuckets; ++i) {
+			if (const auto count = entry.histogram[i]) {
+				histogram.push_back(u"<%1:%2"_q
+					.arg(1ULL << i)
+					.arg(count));
+			}
+		}
+		LOG(("Updates Replay: type 0x%1, %2 updates, %3 mcs average, "
+			"histogram (mcs:count) %4."
+			).arg(uint32(type), 8, 16, QChar('0')
+			).arg(entry.count
+			).arg(entry.count ? (entry.total / entry.count) : 0
+			).arg(histogram.join(' ')));
+	}
+}
+
+void SetupUpdatesRecording(not_null<Main::Session*> session) {
+	const auto record = qEnvironmentVariable(kRecordVariable);
+	if (!record.isEmpty()) {
+		session->updatesRecorder().start(record);
+	}
+	const auto replay = qEnvironmentVariable(kReplayVariable);
+	if (replay.isEmpty()) {
+		return;
+	}
+	crl::on_main(session, [=] {
+		LOG(("Updates Replay: Replaying '%1'.").arg(replay));
+		if (const auto stats = UpdatesReplay(session).run(replay)) {
+			UpdatesReplay::Log(*stats);
+		}
+	});
+}
+
+} // namespace Api
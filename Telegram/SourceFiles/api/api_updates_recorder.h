@@ -0,0 +1,123 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+class QFile;
+class QDataStream;
+
+namespace Main {
+class Session;
+} // namespace Main
+
+namespace Api {
+
+enum class UpdatesFrameType : quint32 {
+	Updates = 1,
+	Difference = 2,
+	ChannelDifference = 3,
+};
+
+// Writes the raw MTPUpdates stream and getDifference responses
+// as they reach Api::Updates, so they can be replayed offline.
+class UpdatesRecorder final {
+public:
+	UpdatesRecorder();
+	~UpdatesRecorder();
+
+	bool start(const QString &path);
+	void stop();
+	[[nodiscard]] bool recording() const {
+		return _stream != nullptr;
+	}
+
+	void record(const MTPUpdates &updates);
+	void record(const MTPupdates_Difference &difference);
+	void record(const MTPupdates_ChannelDifference &difference);
+
+private:
+	template <typename MTPType>
+	void write(UpdatesFrameType type, const MTPType &data);
+
+	std::unique_ptr<QFile> _file;
+	std::unique_ptr<QDataStream> _stream;
+	crl::time _started = 0;
+	int64 _frames = 0;
+
+};
+
+struct UpdatesReplayStats {
+	// Bucket i counts updates handled in [2^(i-1), 2^i) microseconds.
+	static constexpr auto kLatencyBuckets = 24;
+
+	struct Type {
+		int64 count = 0;
+		crl::profile_time total = 0;
+		std::array<int64, kLatencyBuckets> histogram = {};
+	};
+
+	int64 frames = 0;
+	int64 updates = 0;
+	int64 skipped = 0; // Need a live connection, like updatesTooLong.
+	crl::profile_time duration = 0;
+
+	// Catch-up: the recorded time from the first till the last
+	// getDifference response against the time to only apply them.
+	int64 differenceFrames = 0;
+	crl::time differenceRecorded = 0;
+	crl::profile_time differenceApply = 0;
+
+	// HistoryItem slab allocations while replaying.
+	int64 itemAllocations = 0;
+	int64 itemFrees = 0;
+
+	base::flat_map<mtpTypeId, Type> types;
+
+	[[nodiscard]] double updatesPerSecond() const;
+};
+
+// Feeds a recorded file to the session as fast as possible.
+//
+// All pts / seq checks are skipped, the recorded state can't match
+// the state of the session it is replayed in, and a gap would send
+// getDifference to the server instead of measuring anything. The dates
+// of the session state still may move, so use a throwaway session.
+class UpdatesReplay final {
+public:
+	explicit UpdatesReplay(not_null<Main::Session*> session);
+
+	[[nodiscard]] std::optional<UpdatesReplayStats> run(
+		const QString &path);
+
+	static void Log(const UpdatesReplayStats &stats);
+
+private:
+	void feed(const MTPUpdates &updates);
+	void feed(const MTPupdates_Difference &difference);
+	void feed(const MTPupdates_ChannelDifference &difference);
+	void feedDifference(
+		const MTPVector<MTPUser> &users,
+		const MTPVector<MTPChat> &chats,
+		const MTPVector<MTPMessage> &messages,
+		const MTPVector<MTPUpdate> &other);
+	void feedUpdate(const MTPUpdate &update, TimeId date);
+	template <typename Handler>
+	void measure(mtpTypeId type, Handler &&handler);
+
+	const not_null<Main::Session*> _session;
+	UpdatesReplayStats _stats;
+
+};
+
+// Debug entry points, both take a file path from the environment:
+// TDESKTOP_UPDATES_RECORD starts recording when the session is created,
+// TDESKTOP_UPDATES_REPLAY replays the file once the session is ready and
+// writes UpdatesReplay::Log() to the log. Replay only with a throwaway
+// account, it changes the session data.
+void SetupUpdatesRecording(not_null<Main::Session*> session);
+
+} // namespace Api
@@ -0,0 +1,125 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "api/api_updates_seq.h"
+
+namespace Api {
+namespace {
+
+[[nodiscard]] int Bucket(int64 value) {
+	auto result = 0;
+	while (value > 1 && result + 1 < UpdatesSeqBuffer::kHistogramSize) {
+		value >>= 1;
+		++result;
+	}
+	return result;
+}
+
+[[nodiscard]] int Weight(const MTPUpdates &updates) {
+	return updates.match([](const MTPDupdates &data) {
+		return int(data.vupdates().v.size()
+			+ data.vusers().v.size()
+			+ data.vchats().v.size());
+	}, [](const MTPDupdatesCombined &data) {
+		return int(data.vupdates().v.size()
+			+ data.vusers().v.size()
+			+ data.vchats().v.size());
+	}, [](const auto &) {
+		return 1;
+	});
+}
+
+[[nodiscard]] QString FormatHistogram(
+		const UpdatesSeqBuffer::Histogram &histogram) {
+	auto result = QStringList();
+	for (auto i = 0; i != UpdatesSeqBuffer::kHistogramSize; ++i) {
+		if (histogram[i]) {
+			result.push_back(u"<%1: %2"_q
+				.arg(int64(2) << i)
+				.arg(histogram[i]));
+		}
+	}
+	return result.join(", ");
+}
+
+} // namespace
+
+bool UpdatesSeqBuffer::push(
+		int32 seq,
+		int32 localSeq,
+		const MTPUpdates &updates) {
+	Expects(seq > localSeq + 1);
+
+	const auto weight = Weight(updates);
+	if (_entries.size() >= kMaxEntries || _weight + weight > kMaxWeight) {
+		++_stats.overflows;
+		return false;
+	}
+	const auto [i, ok] = _entries.emplace(seq, Entry{
+		.updates = updates,
+		.received = crl::now(),
+		.weight = weight,
+	});
+	if (ok) {
+		_weight += weight;
+		++_stats.buffered;
+		++_stats.gaps[Bucket(seq - localSeq - 1)];
+		accumulate_max(_stats.entriesPeak, int(_entries.size()));
+		accumulate_max(_stats.weightPeak, _weight);
+	}
+	return true;
+}
+
+std::optional<MTPUpdates> UpdatesSeqBuffer::takeNext(int32 localSeq) {
+	while (!_entries.empty()) {
+		const auto i = _entries.begin();
+		if (i->first > localSeq + 1) {
+			break;
+		} else if (i->first <= localSeq) {
+			remove(i, false);
+			continue;
+		}
+		auto result = std::move(i->second.updates);
+		remove(i, true);
+		return result;
+	}
+	return std::nullopt;
+}
+
+void UpdatesSeqBuffer::clear() {
+	if (_entries.empty()) {
+		return;
+	}
+	while (!_entries.empty()) {
+		remove(_entries.begin(), false);
+	}
+	logStats();
+}
+
+void UpdatesSeqBuffer::remove(
+		base::flat_map<int32, Entry>::iterator i,
+		bool drained) {
+	++_stats.waits[Bucket(crl::now() - i->second.received)];
+	++(drained ? _stats.drained : _stats.dropped);
+	_weight -= i->second.weight;
+	_entries.erase(i);
+}
+
+void UpdatesSeqBuffer::logStats() const {
+	DEBUG_LOG(("Updates Seq Buffer: %1 buffered, %2 drained, %3 dropped, "
+		"%4 overflows, peak %5 entries of %6 weight. Gaps: %7. Waits: %8."
+		).arg(_stats.buffered
+		).arg(_stats.drained
+		).arg(_stats.dropped
+		).arg(_stats.overflows
+		).arg(_stats.entriesPeak
+		).arg(_stats.weightPeak
+		).arg(FormatHistogram(_stats.gaps)
+		).arg(FormatHistogram(_stats.waits)));
+}
+
+} // namespace Api
@@ -0,0 +1,76 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+namespace Api {
+
+// Containers with seq ahead of the local state wait here for the gap
+// before them to be filled.
+//
+// Entries keep the MTPUpdates value, which shares its data with the
+// received one, with the time it was received and its weight: the count
+// of updates, users and chats it keeps alive. When the buffer is over
+// kMaxEntries or kMaxWeight nothing more is buffered and the caller
+// should fall back to getDifference instead of waiting for the gap.
+class UpdatesSeqBuffer final {
+public:
+	static constexpr auto kHistogramSize = 16; // Power of two buckets.
+	using Histogram = std::array<int64, kHistogramSize>;
+
+	struct Stats {
+		int64 buffered = 0;
+		int64 drained = 0;
+		int64 dropped = 0; // Outdated or cleared by getDifference.
+		int64 overflows = 0;
+		int entriesPeak = 0;
+		int weightPeak = 0;
+		Histogram gaps = {}; // Missing seq count when buffered.
+		Histogram waits = {}; // Milliseconds till drained or dropped.
+	};
+
+	// Returns false if the buffer is full and it was not buffered.
+	[[nodiscard]] bool push(
+		int32 seq,
+		int32 localSeq,
+		const MTPUpdates &updates);
+
+	// The entry following localSeq, outdated ones are dropped on the way.
+	[[nodiscard]] std::optional<MTPUpdates> takeNext(int32 localSeq);
+
+	void clear();
+
+	[[nodiscard]] bool empty() const {
+		return _entries.empty();
+	}
+	[[nodiscard]] int weight() const {
+		return _weight;
+	}
+	[[nodiscard]] const Stats &stats() const {
+		return _stats;
+	}
+	void logStats() const;
+
+private:
+	static constexpr auto kMaxEntries = 64;
+	static constexpr auto kMaxWeight = 4096;
+
+	struct Entry {
+		MTPUpdates updates;
+		crl::time received = 0;
+		int weight = 0;
+	};
+
+	void remove(base::flat_map<int32, Entry>::iterator i, bool drained);
+
+	base::flat_map<int32, Entry> _entries;
+	int _weight = 0;
+	Stats _stats;
+
+};
+
+} // namespace Api
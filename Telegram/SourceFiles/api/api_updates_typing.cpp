@@ -0,0 +1,153 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "api/api_updates_typing.h"
+
+namespace Api {
+namespace {
+
+constexpr auto kFrameWindow = crl::time(16);
+constexpr auto kRowInterval = crl::time(100);
+
+// Servers repeat typing each 5 seconds and it is shown for 6 seconds.
+constexpr auto kTypingRepeatSkip = crl::time(1000);
+
+constexpr auto kLogStatsEach = 1000;
+
+// Speaking in calls and emoji interactions are not about a single row
+// repaint and their order matters, so they are applied right away.
+[[nodiscard]] bool Coalesced(mtpTypeId type) {
+	return (type != mtpc_speakingInGroupCallAction)
+		&& (type != mtpc_sendMessageEmojiInteraction)
+		&& (type != mtpc_sendMessageEmojiInteractionSeen);
+}
+
+} // namespace
+
+TypingCoalescer::TypingCoalescer()
+: _timer([=] { flush(); }) {
+}
+
+void TypingCoalescer::setHandler(Handler handler) {
+	_handler = std::move(handler);
+}
+
+void TypingCoalescer::push(
+		PeerId peerId,
+		MsgId rootId,
+		PeerId fromId,
+		const MTPSendMessageAction &action) {
+	++_stats.received;
+	if (!Coalesced(action.type())) {
+		apply(peerId, rootId, fromId, action);
+		return;
+	}
+	auto &row = _rows[Row{ peerId, rootId }];
+	const auto i = ranges::find(row.pending, fromId, &Pending::fromId);
+	if (i != end(row.pending)) {
+		i->action = action;
+		++_stats.merged;
+		return;
+	} else if (action.type() == mtpc_sendMessageTypingAction) {
+		const auto j = row.typingApplied.find(fromId);
+		if (j != end(row.typingApplied)
+			&& crl::now() - j->second < kTypingRepeatSkip) {
+			++_stats.limited;
+			return;
+		}
+	}
+	row.pending.push_back({ fromId, action });
+	if (!_timer.isActive()) {
+		_timer.callOnce(kFrameWindow);
+	}
+}
+
+void TypingCoalescer::messageReceived(PeerId peerId, PeerId fromId) {
+	for (auto i = _rows.lower_bound(Row{ peerId, MsgId() })
+		; i != end(_rows) && i->first.peerId == peerId
+		; ++i) {
+		auto &state = i->second;
+		state.typingApplied.remove(fromId);
+		const auto j = ranges::find(state.pending, fromId, &Pending::fromId);
+		if (j != end(state.pending)) {
+			state.pending.erase(j);
+		}
+	}
+}
+
+void TypingCoalescer::apply(
+		PeerId peerId,
+		MsgId rootId,
+		PeerId fromId,
+		const MTPSendMessageAction &action) {
+	++_stats.applied;
+	if (_handler) {
+		_handler(peerId, rootId, fromId, action);
+	}
+}
+
+void TypingCoalescer::flush() {
+	const auto now = crl::now();
+	const auto wasFlushes = _stats.rowFlushes;
+	auto ready = std::vector<std::pair<Row, Pending>>();
+	auto wake = crl::time();
+	for (auto i = begin(_rows); i != end(_rows);) {
+		auto &[row, state] = *i;
+		if (!state.pending.empty()) {
+			const auto allowed = state.flushed + kRowInterval;
+			if (now >= allowed) {
+				for (auto &pending : state.pending) {
+					if (pending.action.type() == mtpc_sendMessageTypingAction) {
+						state.typingApplied[pending.fromId] = now;
+					} else {
+						state.typingApplied.remove(pending.fromId);
+					}
+					ready.emplace_back(row, std::move(pending));
+				}
+				state.pending.clear();
+				state.flushed = now;
+				++_stats.rowFlushes;
+			} else if (!wake || wake > allowed) {
+				wake = allowed;
+			}
+		}
+		for (auto j = begin(state.typingApplied)
+			; j != end(state.typingApplied);) {
+			if (now - j->second >= kTypingRepeatSkip) {
+				j = state.typingApplied.erase(j);
+			} else {
+				++j;
+			}
+		}
+		if (state.pending.empty()
+			&& state.typingApplied.empty()
+			&& now - state.flushed >= kRowInterval) {
+			i = _rows.erase(i);
+		} else {
+			++i;
+		}
+	}
+	if (wake) {
+		_timer.callOnce(std::max(wake - now, kFrameWindow));
+	}
+
+	// Handlers may push again, so they are called after the loop.
+	for (const auto &[row, pending] : ready) {
+		apply(row.peerId, row.rootId, pending.fromId, pending.action);
+	}
+	if (wasFlushes / kLogStatsEach != _stats.rowFlushes / kLogStatsEach) {
+		DEBUG_LOG(("Typing Coalescer: %1 received, %2 merged, "
+			"%3 limited, %4 applied in %5 row flushes."
+			).arg(_stats.received
+			).arg(_stats.merged
+			).arg(_stats.limited
+			).arg(_stats.applied
+			).arg(_stats.rowFlushes));
+	}
+}
+
+} // namespace Api
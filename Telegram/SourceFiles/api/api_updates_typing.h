@@ -0,0 +1,85 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "base/timer.h"
+
+namespace Api {
+
+// Send actions from typing updates are merged per (peer, topic) row
+// over a frame window before they reach the send action manager.
+//
+// Only the latest action of each author in a row is kept, a row is
+// flushed at most once per kRowInterval, and a repeated "typing" of
+// the same author is skipped while the previous one is still fresh.
+// A message of the author clears the indicator, so it is forgotten.
+class TypingCoalescer final {
+public:
+	using Handler = Fn<void(
+		PeerId peerId,
+		MsgId rootId,
+		PeerId fromId,
+		const MTPSendMessageAction &action)>;
+
+	struct Stats {
+		int64 received = 0; // Blocked authors are dropped before.
+		int64 merged = 0; // Replaced by a later action of the author.
+		int64 limited = 0; // Repeated typing of the same author.
+		int64 applied = 0;
+		int64 rowFlushes = 0; // At most one per row in kRowInterval.
+	};
+
+	TypingCoalescer();
+
+	void setHandler(Handler handler);
+	void push(
+		PeerId peerId,
+		MsgId rootId,
+		PeerId fromId,
+		const MTPSendMessageAction &action);
+
+	// Drops pending actions and the applied typing in all peer rows.
+	void messageReceived(PeerId peerId, PeerId fromId);
+
+	[[nodiscard]] const Stats &stats() const {
+		return _stats;
+	}
+
+private:
+	struct Row {
+		PeerId peerId = 0;
+		MsgId rootId = 0;
+
+		friend inline auto operator<=>(Row, Row) = default;
+	};
+	struct Pending {
+		PeerId fromId = 0;
+		MTPSendMessageAction action;
+	};
+	struct RowState {
+		std::vector<Pending> pending;
+		base::flat_map<PeerId, crl::time> typingApplied;
+		crl::time flushed = 0;
+	};
+
+	void apply(
+		PeerId peerId,
+		MsgId rootId,
+		PeerId fromId,
+		const MTPSendMessageAction &action);
+	void flush();
+
+	Handler _handler;
+
+	base::flat_map<Row, RowState> _rows;
+	base::Timer _timer;
+	Stats _stats;
+
+};
+
+} // namespace Api
@@ -21,6 +21,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "base/random.h"
 #include "main/main_session.h"
 #include "window/notifications_manager.h"
+#include "window/window_session_controller.h" // kg
 #include "history/history.h"
 #include "history/history_item.h"
 #include "history/history_item_helpers.h"
@@ -32,6 +33,12 @@ namespace Data {
 namespace {
 
 constexpr auto kReadRequestTimeout = 3 * crl::time(1000);
+constexpr auto kMemoryBudgetCheckPeriod = 30 * crl::time(1000);
+constexpr auto kDefaultMemoryBudget = int64(64) * 1024 * 1024;
+constexpr auto kKgRelayoutSliceBudget = crl::time(8); // Half of a frame.
+constexpr auto kKgRelayoutVisibleBlocks = 1;
+constexpr auto kKgLastVisiblePerPage = 20;
+constexpr auto kKgDroppedPerRequest = 100;
 
 } // namespace
 
@@ -100,7 +107,10 @@ MTPInputMedia WebPageForMTP(
 
 Histories::Histories(not_null<Session*> owner)
 : _owner(owner)
-, _readRequestsTimer([=] { sendReadRequests(); }) {
+, _readRequestsTimer([=] { sendReadRequests(); })
+, _memoryBudgetTimer([=] { checkMemoryBudget(); })
+, _kgRelayoutTimer([=] { kgRelayoutSlice(); }) { // kg
+	setMemoryBudget(kDefaultMemoryBudget);
 }
 
 Session &Histories::owner() const {
@@ -135,9 +145,105 @@ void Histories::unloadAll() {
 }
 
 void Histories::clearAll() {
+	_lastViewed.clear();
 	_map.clear();
 }
 
+void Histories::setMemoryBudget(int64 bytes) {
+	_unloadStats.budget = bytes;
+	if (bytes > 0) {
+		_memoryBudgetTimer.callEach(kMemoryBudgetCheckPeriod);
+	} else {
+		_memoryBudgetTimer.cancel();
+	}
+}
+
+HistoryItemSlab::Stats Histories::itemsAllocationStats() const {
+	auto result = HistoryItemSlab::Stats();
+	for (const auto &[peerId, history] : _map) {
+		const auto &stats = history->itemsAllocationStats();
+		result.allocations += stats.allocations;
+		result.frees += stats.frees;
+		result.heapFallbacks += stats.heapFallbacks;
+		result.live += stats.live;
+		result.chunks += stats.chunks;
+		result.chunksPeak += stats.chunksPeak;
+		result.chunksReleased += stats.chunksReleased;
+	}
+	return result;
+}
+
+bool Histories::isOpened(not_null<History*> history) const {
+	// The chat section shows the migrated history above the current one.
+	const auto shows = [&](const Dialogs::Key &key) {
+		const auto shown = key.owningHistory();
+		return shown
+			&& (shown == history || shown->migrateSibling() == history);
+	};
+	return ranges::any_of(session().windows(), [&](
+			not_null<Window::SessionController*> window) {
+		// Sections (replies, pinned, scheduled) report their chat
+		// in the entry state, the history widget in the active chat.
+		return shows(window->activeChatCurrent())
+			|| shows(window->currentDialogsEntryState().key);
+	});
+}
+
+void Histories::checkMemoryBudget() {
+	const auto now = crl::now();
+	auto &stats = _unloadStats;
+	++stats.checks;
+	stats.lastCheck = now;
+
+	struct Candidate {
+		not_null<History*> history;
+		crl::time viewed = 0;
+		int64 bytes = 0;
+	};
+	auto candidates = std::vector<Candidate>();
+	auto total = int64();
+	for (const auto &[peerId, owned] : _map) {
+		const auto history = owned.get();
+		const auto bytes = history->memoryEstimate();
+		total += bytes;
+
+		// Histories are stamped as viewed while they are opened,
+		// the rest keep the time they were first seen here.
+		auto &viewed = _lastViewed[history];
+		if (!viewed || isOpened(history)) {
+			viewed = now;
+			continue;
+		} else if (!bytes
+			|| history->isPinnedDialog(FilterId())
+			|| _states.contains(history)) {
+			// No views to free, pinned or with requests in flight.
+			continue;
+		}
+		candidates.push_back({ history, viewed, bytes });
+	}
+	stats.estimated = total;
+	if (total <= stats.budget) {
+		return;
+	}
+	ranges::sort(candidates, ranges::less(), &Candidate::viewed);
+	for (const auto &candidate : candidates) {
+		const auto history = candidate.history;
+		history->clear(History::ClearType::Unload);
+		const auto freed = candidate.bytes - history->memoryEstimate();
+		stats.freed += freed;
+		total -= freed;
+		++stats.unloaded;
+		if (total <= stats.budget) {
+			break;
+		}
+	}
+	stats.estimated = total;
+	DEBUG_LOG(("Histories: %1 bytes estimated after unloading, "
+		"%2 histories unloaded in total."
+		).arg(total
+		).arg(stats.unloaded));
+}
+
 // kg begin
 void Histories::kgRefreshAll(bool invalidateKgData) {
 	for (const auto &[peerId, history] : _map) {
@@ -146,6 +252,87 @@ void Histories::kgRefreshAll(bool invalidateKgData) {
 		history->kgRefreshAll(invalidateKgData);
 	}
 }
+
+void Histories::kgRefreshAuthor(BareId authorId) {
+	for (const auto &[peerId, history] : _map) {
+		if (history->peer.get()->isUser()) continue;
+		if (history->peer.get()->isBlocked()) continue;
+		history->kgRefreshAuthor(authorId);
+	}
+}
+
+void Histories::kgScheduleRelayout(not_null<HistoryItem*> item) {
+	const auto id = item->fullId();
+	if (!_kgRelayoutQueued.emplace(id).second) {
+		return;
+	} else if (kgRelayoutVisibleFirst(item)) {
+		_kgRelayoutVisible.push_back(id);
+	} else {
+		_kgRelayoutRest.push_back(id);
+	}
+	if (!_kgRelayoutTimer.isActive()) {
+		if (!_kgRelayoutStats.started) {
+			_kgRelayoutStats = { .started = crl::now() };
+		}
+		_kgRelayoutTimer.callOnce(0);
+	}
+}
+
+bool Histories::kgRelayoutVisibleFirst(not_null<HistoryItem*> item) const {
+	const auto history = item->history();
+	const auto view = item->mainView();
+	if (!view || history->blocks.empty()) {
+		return false;
+	}
+	if (!isOpened(history)) {
+		return false;
+	}
+	// Without a scrollTopItem the history is scrolled to the bottom.
+	const auto top = history->scrollTopItem
+		? history->scrollTopItem->block()->indexInHistory()
+		: int(history->blocks.size()) - 1;
+	const auto index = view->block()->indexInHistory();
+	return (index >= top - kKgRelayoutVisibleBlocks)
+		&& (index <= top + kKgRelayoutVisibleBlocks);
+}
+
+void Histories::kgRelayoutSlice() {
+	const auto started = crl::now();
+	const auto till = started + kKgRelayoutSliceBudget;
+	auto &stats = _kgRelayoutStats;
+	while (!_kgRelayoutVisible.empty() || !_kgRelayoutRest.empty()) {
+		auto &queue = _kgRelayoutVisible.empty()
+			? _kgRelayoutRest
+			: _kgRelayoutVisible;
+		const auto id = queue.front();
+		queue.pop_front();
+		_kgRelayoutQueued.erase(id);
+		if (const auto item = _owner->message(id)) {
+			if (item->mainView()) {
+				_owner->notifyItemDataChange(item);
+				_owner->requestItemResize(item);
+				++stats.items;
+			}
+		}
+		if (crl::now() >= till) {
+			break;
+		}
+	}
+	const auto duration = crl::now() - started;
+	++stats.slices;
+	stats.longestSlice = std::max(stats.longestSlice, duration);
+	if (!_kgRelayoutQueued.empty()) {
+		_kgRelayoutTimer.callOnce(0);
+		return;
+	}
+	DEBUG_LOG(("KG Relayout: %1 items in %2 slices, "
+		"longest slice %3 ms, total %4 ms."
+		).arg(stats.items
+		).arg(stats.slices
+		).arg(stats.longestSlice
+		).arg(crl::now() - stats.started));
+	stats.started = 0;
+}
 // kg end
 
 void Histories::readInbox(not_null<History*> history) {
@@ -519,6 +706,82 @@ void Histories::requestFakeChatListMessage(
 	});
 }
 
+void Histories::kgRequestLastVisible(
+		not_null<History*> history,
+		MsgId offsetId,
+		int pagesLeft) {
+	if (!_kgLastVisibleRequests.emplace(history).second) {
+		return;
+	}
+	// The chat list row paint asks for it, send outside of the paint.
+	crl::on_main(&session(), [=] {
+		kgSendLastVisibleRequest(history, offsetId, pagesLeft);
+	});
+}
+
+void Histories::kgSendLastVisibleRequest(
+		not_null<History*> history,
+		MsgId offsetId,
+		int pagesLeft) {
+	sendRequest(history, RequestType::History, [=](Fn<void()> finish) {
+		return session().api().request(MTPmessages_GetHistory(
+			history->peer->input,
+			MTP_int(offsetId),
+			MTP_int(0), // offset_date
+			MTP_int(0), // add_offset
+			MTP_int(kKgLastVisiblePerPage),
+			MTP_int(0), // max_id
+			MTP_int(0), // min_id
+			MTP_long(0) // hash
+		)).done([=](const MTPmessages_Messages &result) {
+			_kgLastVisibleRequests.erase(history);
+			history->kgSetLastVisibleFrom(result, pagesLeft);
+			finish();
+		}).fail([=] {
+			_kgLastVisibleRequests.erase(history);
+			history->kgSetLastVisibleFrom(MTP_messages_messages(
+				MTP_vector<MTPMessage>(0),
+				MTP_vector<MTPChat>(0),
+				MTP_vector<MTPUser>(0)), pagesLeft);
+			finish();
+		}).send();
+	});
+}
+
+void Histories::kgRequestDropped(
+		not_null<History*> history,
+		std::vector<MsgId> ids) {
+	const auto channel = history->peer->asChannel();
+	for (auto from = begin(ids); from != end(ids);) {
+		const auto till = from + std::min(
+			int(end(ids) - from),
+			kKgDroppedPerRequest);
+		auto list = QVector<MTPInputMessage>();
+		list.reserve(till - from);
+		for (const auto &id : ranges::make_subrange(from, till)) {
+			list.push_back(MTP_inputMessageID(MTP_int(id)));
+		}
+		from = till;
+		sendRequest(history, RequestType::History, [=](Fn<void()> finish) {
+			const auto done = [=](const MTPmessages_Messages &result) {
+				history->kgReplaceDropped(result);
+				finish();
+			};
+			const auto fail = [=] {
+				finish();
+			};
+			return channel
+				? session().api().request(MTPchannels_GetMessages(
+					channel->inputChannel,
+					MTP_vector<MTPInputMessage>(list)
+				)).done(done).fail(fail).send()
+				: session().api().request(MTPmessages_GetMessages(
+					MTP_vector<MTPInputMessage>(list)
+				)).done(done).fail(fail).send();
+		});
+	}
+}
+
 void Histories::requestGroupAround(not_null<HistoryItem*> item) {
 	const auto history = item->history();
 	const auto id = item->id;
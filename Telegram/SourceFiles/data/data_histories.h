@@ -8,6 +8,8 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #pragma once
 
 #include "base/timer.h"
+#include "data/data_types.h" // kg FullMsgIdHash
+#include "history/history_item_slab.h"
 
 class History;
 class HistoryItem;
@@ -57,7 +59,53 @@ public:
 	void unloadAll();
 	void clearAll();
 
-	void kgRefreshAll(bool invalidateKgData); // kg
+	struct UnloadStats {
+		int64 budget = 0;
+		int64 estimated = 0; // At the last check.
+		int64 freed = 0;
+		int checks = 0;
+		int unloaded = 0;
+		crl::time lastCheck = 0;
+	};
+
+	// Least recently viewed histories are unloaded above the budget,
+	// zero budget disables unloading.
+	void setMemoryBudget(int64 bytes);
+	[[nodiscard]] const UnloadStats &unloadStats() const {
+		return _unloadStats;
+	}
+
+	// Summed over the item slabs of all loaded histories.
+	[[nodiscard]] HistoryItemSlab::Stats itemsAllocationStats() const;
+
+	// kg begin
+	struct KgRelayoutStats {
+		int items = 0;
+		int slices = 0;
+		crl::time longestSlice = 0;
+		crl::time started = 0;
+	};
+
+	void kgRefreshAll(bool invalidateKgData);
+	void kgRefreshAuthor(BareId authorId);
+
+	// Visible items are laid out first, the rest in time-bounded slices.
+	void kgScheduleRelayout(not_null<HistoryItem*> item);
+	[[nodiscard]] const KgRelayoutStats &kgRelayoutStats() const {
+		return _kgRelayoutStats;
+	}
+
+	// Loads older messages until one from a non-blocked author is found.
+	void kgRequestLastVisible(
+		not_null<History*> history,
+		MsgId offsetId,
+		int pagesLeft);
+
+	// Requests the messages that were kept as tombstones to replace them.
+	void kgRequestDropped(
+		not_null<History*> history,
+		std::vector<MsgId> ids);
+	// kg end
 
 	void readInbox(not_null<History*> history);
 	void readInboxTill(not_null<HistoryItem*> item);
@@ -204,6 +252,19 @@ private:
 
 	void sendDialogRequests();
 
+	[[nodiscard]] bool isOpened(not_null<History*> history) const;
+	void checkMemoryBudget();
+
+	// kg begin
+	[[nodiscard]] bool kgRelayoutVisibleFirst(
+		not_null<HistoryItem*> item) const;
+	void kgRelayoutSlice();
+	void kgSendLastVisibleRequest(
+		not_null<History*> history,
+		MsgId offsetId,
+		int pagesLeft);
+	// kg end
+
 	[[nodiscard]] bool isCreatingTopic(
 		not_null<History*> history,
 		MsgId rootId) const;
@@ -228,6 +289,10 @@ private:
 
 	base::flat_set<not_null<History*>> _fakeChatListRequests;
 
+	base::flat_map<not_null<History*>, crl::time> _lastViewed;
+	base::Timer _memoryBudgetTimer;
+	UnloadStats _unloadStats;
+
 	base::flat_map<
 		GroupRequestKey,
 		ChatListGroupRequest> _chatListGroupRequests;
@@ -238,6 +303,15 @@ private:
 	base::flat_map<FullMsgId, MsgId> _createdTopicIds;
 	base::flat_set<mtpRequestId> _creatingTopicRequests;
 
+	// kg begin
+	std::deque<FullMsgId> _kgRelayoutVisible;
+	std::deque<FullMsgId> _kgRelayoutRest;
+	std::unordered_set<FullMsgId, FullMsgIdHash> _kgRelayoutQueued;
+	KgRelayoutStats _kgRelayoutStats;
+	base::Timer _kgRelayoutTimer;
+	base::flat_set<not_null<History*>> _kgLastVisibleRequests;
+	// kg end
+
 };
 
 } // namespace Data
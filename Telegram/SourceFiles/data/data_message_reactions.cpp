@@ -10,6 +10,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "history/history.h"
 #include "history/history_item.h"
 #include "history/history_item_components.h"
+#include "history/history_unread_things.h"
 #include "main/main_session.h"
 #include "main/main_app_config.h"
 #include "main/session/send_as_peers.h"
@@ -26,9 +27,12 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "storage/localimageloader.h"
 #include "ui/image/image_location_factory.h"
 #include "ui/animated_icon.h"
+#include "core/application.h"
 #include "mtproto/mtproto_config.h"
 #include "base/timer_rpl.h"
 #include "base/call_delayed.h"
+#include "api/api_unread_things.h" // kg
+#include "api/api_updates_dispatcher.h"
 #include "apiwrap.h"
 #include "styles/style_chat.h"
 
@@ -37,6 +41,12 @@ namespace {
 
 constexpr auto kRefreshFullListEach = 60 * 60 * crl::time(1000);
 constexpr auto kPollEach = 20 * crl::time(1000);
+constexpr auto kPollActiveEach = 10 * crl::time(1000);
+constexpr auto kPollBackgroundEach = 60 * crl::time(1000);
+constexpr auto kPollIdleEach = 120 * crl::time(1000);
+constexpr auto kPollActivityTimeout = 60 * crl::time(1000);
+constexpr auto kPollIdleTimeout = 60 * crl::time(1000);
+constexpr auto kPollStatsPeriod = 60 * crl::time(1000);
 constexpr auto kSizeForDownscale = 64;
 constexpr auto kRecentRequestTimeout = 10 * crl::time(1000);
 constexpr auto kRecentReactionsLimit = 40;
@@ -275,8 +285,11 @@ Reactions::Reactions(not_null<Session*> owner)
 		MessageUpdate::Flag::Destroyed
 	) | rpl::start_with_next([=](const MessageUpdate &update) {
 		const auto item = update.item;
-		_pollingItems.remove(item);
-		_pollItems.remove(item);
+		const auto i = _pollPeers.find(item->history()->peer);
+		if (i != end(_pollPeers)) {
+			i->second.items.remove(item);
+			i->second.polling.remove(item);
+		}
 		_repaintItems.remove(item);
 	}, _lifetime);
 
@@ -1367,31 +1380,73 @@ void Reactions::send(not_null<HistoryItem*> item, bool addToRecent) {
 	}).send();
 }
 
+void Reactions::applyUpdate(const MTPDupdateMessageReactions &data) {
+	const auto peer = peerFromMTP(data.vpeer());
+	const auto &reactions = data.vreactions();
+	auto &unreadThings = _owner->session().api().unreadThings();
+	if (!reactions.data().is_min()) {
+		unreadThings.rememberReactions(
+			FullMsgId(peer, data.vmsg_id().v),
+			reactions); // kg
+	}
+	const auto history = _owner->historyLoaded(peer);
+	if (!history) {
+		return;
+	} else if (const auto item = _owner->message(peer, data.vmsg_id().v)) {
+		item->updateReactions(&reactions);
+		return;
+	}
+	const auto hasUnreadReaction = _owner->session().kgMode()
+		? unreadThings.hasUnreadReactionFromNonBlockedUser(reactions) // kg
+		: HasUnread(reactions);
+	if (hasUnreadReaction || history->unreadReactions().has()) {
+		// The unread reactions count could change.
+		_owner->histories().requestDialogEntry(history);
+	}
+	if (hasUnreadReaction) {
+		history->unreadReactions().checkAdd(data.vmsg_id().v);
+	}
+}
+
 void Reactions::poll(not_null<HistoryItem*> item, crl::time now) {
 	// Group them by one second.
 	const auto last = item->lastReactionsRefreshTime();
 	const auto grouped = ((last + 999) / 1000) * 1000;
-	if (!grouped || item->history()->peer->isUser()) {
+	const auto peer = item->history()->peer;
+	if (!grouped || peer->isUser()) {
 		// First reaction always edits message.
 		return;
-	} else if (const auto left = grouped + kPollEach - now; left > 0) {
+	}
+	const auto interval = pollInterval(peer, now);
+	if (const auto left = grouped + interval - now; left > 0) {
 		if (!_repaintItems.contains(item)) {
-			_repaintItems.emplace(item, grouped + kPollEach);
+			_repaintItems.emplace(item, grouped + interval);
 			if (!_repaintTimer.isActive()
 				|| _repaintTimer.remainingTime() > left) {
 				_repaintTimer.callOnce(left);
 			}
 		}
-	} else if (!_pollingItems.contains(item)) {
-		if (_pollItems.empty() && !_pollRequestId) {
-			crl::on_main(&_owner->session(), [=] {
-				pollCollected();
-			});
-		}
-		_pollItems.emplace(item);
+	} else if (auto &entry = _pollPeers[peer]; !entry.polling.contains(item)) {
+		entry.items.emplace(item);
+		pollSchedule();
 	}
 }
 
+crl::time Reactions::pollInterval(
+		not_null<PeerData*> peer,
+		crl::time now) const {
+	if (now - Core::App().lastNonIdleTime() >= kPollIdleTimeout) {
+		return kPollIdleEach;
+	} else if (!Core::App().hasActiveWindow(&_owner->session())) {
+		return kPollBackgroundEach;
+	}
+	const auto i = _pollPeers.find(peer);
+	const auto active = (i != end(_pollPeers))
+		&& i->second.activity
+		&& (now - i->second.activity < kPollActivityTimeout);
+	return active ? kPollActiveEach : kPollEach;
+}
+
 void Reactions::updateAllInHistory(not_null<PeerData*> peer, bool enabled) {
 	if (const auto history = _owner->historyLoaded(peer)) {
 		history->reactionsEnabledChanged(enabled);
@@ -1457,41 +1512,147 @@ void Reactions::repaintCollected() {
 	}
 }
 
-void Reactions::pollCollected() {
-	auto toRequest = base::flat_map<not_null<PeerData*>, QVector<MTPint>>();
-	_pollingItems = std::move(_pollItems);
-	for (const auto &item : _pollingItems) {
-		toRequest[item->history()->peer].push_back(MTP_int(item->id));
+void Reactions::pollSchedule() {
+	if (_pollScheduled) {
+		return;
 	}
+	_pollScheduled = true;
+	crl::on_main(&_owner->session(), [=] {
+		pollCollected();
+	});
+}
+
+void Reactions::pollCollected() {
+	_pollScheduled = false;
+
+	const auto now = crl::now();
+	pollReportStats(now);
+
 	auto &api = _owner->session().api();
-	for (const auto &[peer, ids] : toRequest) {
-		const auto finalize = [=] {
-			const auto now = crl::now();
-			for (const auto &item : base::take(_pollingItems)) {
-				const auto last = item->lastReactionsRefreshTime();
-				if (last && last + kPollEach <= now) {
-					item->updateReactions(nullptr);
-				}
-			}
-			_pollRequestId = 0;
-			if (!_pollItems.empty()) {
-				crl::on_main(&_owner->session(), [=] {
-					pollCollected();
-				});
-			}
-		};
-		_pollRequestId = api.request(MTPmessages_GetMessagesReactions(
-			peer->input,
-			MTP_vector<MTPint>(ids)
+	for (auto &[peer, entry] : _pollPeers) {
+		if (entry.requestId || entry.items.empty()) {
+			continue;
+		}
+		entry.polling = base::take(entry.items);
+		auto ids = QVector<MTPint>();
+		ids.reserve(entry.polling.size());
+		for (const auto &item : entry.polling) {
+			ids.push_back(MTP_int(item->id));
+
+			const auto age = now - item->lastReactionsRefreshTime();
+			_pollStats.ageTotal += age;
+			accumulate_max(_pollStats.ageMax, age);
+		}
+		++_pollStats.requests;
+		_pollStats.items += ids.size();
+
+		const auto owner = peer;
+		entry.requestId = api.request(MTPmessages_GetMessagesReactions(
+			owner->input,
+			MTP_vector<MTPint>(std::move(ids))
 		)).done([=](const MTPUpdates &result) {
-			_owner->session().api().applyUpdates(result);
-			finalize();
+			const auto changed = pollApply(result);
+			pollDone(owner, now, changed);
 		}).fail([=] {
-			finalize();
+			pollDone(owner, now, false);
 		}).send();
 	}
 }
 
+void Reactions::pollDone(
+		not_null<PeerData*> peer,
+		crl::time sent,
+		bool changed) {
+	const auto i = _pollPeers.find(peer);
+	if (i == end(_pollPeers)) {
+		return;
+	}
+	i->second.requestId = 0;
+	if (changed) {
+		i->second.activity = crl::now();
+	}
+	const auto activity = i->second.activity;
+
+	// Items missing in the result don't have reactions anymore.
+	for (const auto &item : base::take(i->second.polling)) {
+		const auto last = item->lastReactionsRefreshTime();
+		if (last && last < sent) {
+			item->updateReactions(nullptr);
+		}
+	}
+
+	const auto j = _pollPeers.find(peer);
+	if (j == end(_pollPeers)) {
+		return;
+	} else if (!j->second.items.empty()) {
+		pollSchedule();
+	} else if (!activity || crl::now() - activity >= kPollActivityTimeout) {
+		_pollPeers.erase(j);
+	}
+}
+
+bool Reactions::pollApply(const MTPUpdates &result) {
+	// Reactions from blocked users are not shown in KG mode,
+	// so they don't count as an activity to poll more often for.
+	const auto count = [](not_null<HistoryItem*> item) {
+		auto sum = 0;
+		for (const auto &reaction : item->reactions()) {
+			sum += reaction.count;
+		}
+		return sum;
+	};
+	auto changed = false;
+	const auto applied = result.match([&](const MTPDupdates &data) {
+		const auto &list = data.vupdates().v;
+		if (!ranges::all_of(list, [](const MTPUpdate &update) {
+			return (update.type() == mtpc_updateMessageReactions);
+		})) {
+			return false;
+		}
+		_owner->processUsers(data.vusers());
+		_owner->processChats(data.vchats());
+		auto &dispatcher = _owner->session().updatesDispatcher();
+		for (const auto &update : list) {
+			const auto &d = update.c_updateMessageReactions();
+			const auto item = _owner->message(
+				peerFromMTP(d.vpeer()),
+				d.vmsg_id().v);
+			const auto was = item ? count(item) : 0;
+			dispatcher.dispatch(update, [&] {
+				applyUpdate(d);
+			});
+			changed |= item && (count(item) != was);
+		}
+		return true;
+	}, [](const auto &) {
+		return false;
+	});
+	if (!applied) {
+		_owner->session().api().applyUpdates(result);
+	}
+	return changed;
+}
+
+void Reactions::pollReportStats(crl::time now) {
+	if (!_pollStats.started) {
+		_pollStats.started = now;
+		return;
+	}
+	const auto elapsed = now - _pollStats.started;
+	if (elapsed < kPollStatsPeriod) {
+		return;
+	} else if (_pollStats.requests) {
+		DEBUG_LOG(("Reactions Poll: %1 requests per minute for %2 items, "
+			"%3 peers tracked, data age %4 ms average, %5 ms max."
+			).arg(_pollStats.requests * kPollStatsPeriod / elapsed
+			).arg(_pollStats.items
+			).arg(_pollPeers.size()
+			).arg(_pollStats.ageTotal / _pollStats.items
+			).arg(_pollStats.ageMax));
+	}
+	_pollStats = PollStats{ .started = now };
+}
+
 bool Reactions::sending(not_null<HistoryItem*> item) const {
 	return _sentRequests.contains(item->fullId());
 }
@@ -1571,17 +1732,16 @@ void MessageReactions::add(const ReactionId &id, bool addToRecent) {
 		return removed;
 	}), end(_list));
 	const auto peer = history->peer;
-	bool from_is_blocked = false; // kg
 	if (_item->canViewReactions() || peer->isUser()) {
 		auto &list = _recent[id];
 		const auto from = peer->session().sendAsPeers().resolveChosen(peer);
-		if (_item->history()->session().userIsBlocked(from.get()->id.value)) from_is_blocked = true; // kg
 		list.insert(begin(list), RecentReaction{
 			.peer = from,
 			.my = true,
 		});
 	}
-	if (!from_is_blocked) invalidateKgData(); // kg
+	invalidateKgData(); // kg, the hidden mask is positional over _recent.
+	kgRecentChanged(); // kg
 	const auto i = ranges::find(_list, id, &MessageReaction::id);
 	if (i != end(_list)) {
 		i->my = true;
@@ -1628,6 +1788,7 @@ void MessageReactions::remove(const ReactionId &id) {
 		}
 	}
 	invalidateKgData(); // kg
+	kgRecentChanged(); // kg
 	if (tags) {
 		const auto sublist = _item->savedSublist();
 		history->owner().reactions().decrementMyTag(id, sublist);
@@ -1767,6 +1928,11 @@ bool MessageReactions::change(
 			}
 		}
 	}
+	if (!min) {
+		_item->history()->session().api().unreadThings().rememberReactions(
+			_item->fullId(),
+			recent); // kg
+	}
 	auto parsed = base::flat_map<ReactionId, std::vector<RecentReaction>>();
 	for (const auto &reaction : recent) {
 		reaction.match([&](const MTPDmessagePeerReaction &data) {
@@ -1793,6 +1959,7 @@ bool MessageReactions::change(
 	if (_recent != parsed) {
 		_recent = std::move(parsed);
 		changed = true;
+		kgRecentChanged(); // kg
 	}
 	if (changed) invalidateKgData(); // kg
 	return changed;
@@ -1808,12 +1975,27 @@ auto MessageReactions::recent() const
 }
 
 bool MessageReactions::empty() const {
-	return listForPublic().empty(); // kg _list.empty();
+	// kg begin
+	if (_item->history()->session().kgMode()) {
+		checkResetKgData();
+		if (_kg_hiddenCount) {
+			return ranges::none_of(_list, [&](const MessageReaction &r) {
+				return (r.count > kgHiddenCount(r.id));
+			});
+		}
+	}
+	// kg end
+	return _list.empty();
 }
 
 bool MessageReactions::hasUnread() const {
-	// for (auto &[emoji, list] : _recent) {
-	for (auto &[emoji, list] : recentForPublic()) { // kg
+	// kg begin
+	if (_item->history()->session().kgMode()) {
+		checkResetKgData();
+		return _kg_hasUnread;
+	}
+	// kg end
+	for (auto &[emoji, list] : _recent) {
 		if (ranges::contains(list, true, &RecentReaction::unread)) {
 			return true;
 		}
@@ -1827,12 +2009,7 @@ void MessageReactions::markRead() {
 			reaction.unread = false;
 		}
 	}
-	// kg
-	for (auto &[emoji, list] : _kg_recent) {
-		for (auto &reaction : list) {
-			reaction.unread = false;
-		}
-	}
+	invalidateKgData(); // kg
 }
 
 std::vector<ReactionId> MessageReactions::chosen() const {
@@ -1845,54 +2022,121 @@ std::vector<ReactionId> MessageReactions::chosen() const {
 // kg begin
 const std::vector<MessageReaction> &MessageReactions::listForPublic() const {
 	if (_item->history()->session().kgMode()) {
-	    checkResetKgData();
-		return _kg_list;
-	} else {
-		return _list;
+		checkResetKgData();
+		if (_kg_hiddenCount) {
+			return kgFiltered().list;
+		}
 	}
+	return _list;
 }
 
 auto MessageReactions::recentForPublic() const
 -> const base::flat_map<ReactionId, std::vector<RecentReaction>> & {
 	if (_item->history()->session().kgMode()) {
-	    checkResetKgData();
-		return _kg_recent;
-	} else {
-		return _recent;
+		checkResetKgData();
+		if (_kg_hiddenCount) {
+			return kgFiltered().recent;
+		}
 	}
+	return _recent;
 }
 
-void MessageReactions::checkResetKgData() const {
-	if (_kg_data_is_actual) return;
+bool MessageReactions::kgHidden(int index, const RecentReaction &r) const {
+	return (index < 64)
+		? ((_kg_hidden & (uint64(1) << index)) != 0)
+		: _item->history()->session().userIsBlocked(r.peer->id.value);
+}
 
-	_kg_list.clear();
-	_kg_recent.clear();
+int MessageReactions::kgHiddenCount(const ReactionId &id) const {
+	auto index = 0;
+	for (const auto &[reactionId, list] : _recent) {
+		if (reactionId != id) {
+			index += int(list.size());
+			continue;
+		}
+		auto result = 0;
+		for (const auto &reaction : list) {
+			result += kgHidden(index++, reaction) ? 1 : 0;
+		}
+		return result;
+	}
+	return 0;
+}
 
-	for (auto &[id, list] : _recent) {
-		for (auto &reaction : list) {
-			if (_item->history()->session().userIsBlocked(reaction.peer.get()->id.value)) continue;
-			_kg_recent[id].push_back(reaction);
+void MessageReactions::checkResetKgData() const {
+	const auto &session = _item->history()->session();
+	const auto generation = session.blockedPeersGeneration();
+	if (_kg_generation == generation) {
+		return;
+	}
+	_kg_generation = generation;
+	_kg_hidden = 0;
+	_kg_hiddenCount = 0;
+	_kg_hasUnread = false;
+	_kg_filtered = nullptr;
+
+	auto index = 0;
+	for (const auto &[id, list] : _recent) {
+		for (const auto &reaction : list) {
+			if (session.userIsBlocked(reaction.peer->id.value)) {
+				if (index < 64) {
+					_kg_hidden |= (uint64(1) << index);
+				}
+				++_kg_hiddenCount;
+			} else if (reaction.unread) {
+				_kg_hasUnread = true;
+			}
+			++index;
+		}
+	}
+}
+
+auto MessageReactions::kgFiltered() const -> const KgFiltered & {
+	if (_kg_filtered) {
+		return *_kg_filtered;
+	}
+	_kg_filtered = std::make_unique<KgFiltered>();
+	auto &result = *_kg_filtered;
+	auto index = 0;
+	for (const auto &[id, list] : _recent) {
+		for (const auto &reaction : list) {
+			if (!kgHidden(index++, reaction)) {
+				result.recent[id].push_back(reaction);
+			}
 		}
 	}
 	for (const auto &reaction : _list) {
-        const auto ir = _recent.find(reaction.id);
-		const auto all_count = (ir != end(_recent)) ? ir->second.size() : size_t(0);
-        const auto ik = _kg_recent.find(reaction.id);
-		const auto our_count = (ik != end(_kg_recent)) ? ik->second.size() : size_t(0);
-		const int new_count = reaction.count - (all_count - our_count);
-		// if (new_count == reaction.count) {
-		// 	_kg_list.push_back(reaction); anyway it will create copy of reaction here!
-		// } else
-		if (new_count > 0) {
-			_kg_list.push_back({ .id = reaction.id, .count = new_count, .my = reaction.my });
+		const auto count = reaction.count - kgHiddenCount(reaction.id);
+		if (count > 0) {
+			result.list.push_back({
+				.id = reaction.id,
+				.count = count,
+				.my = reaction.my,
+			});
 		}
 	}
-
-	_kg_data_is_actual = true;
+	return result;
 }
 
 void MessageReactions::invalidateKgData () const {
-	_kg_data_is_actual = false;
+	_kg_generation = 0;
+	_kg_filtered = nullptr;
+}
+
+std::vector<BareId> MessageReactions::kgRecentReactors() const {
+	auto result = std::vector<BareId>();
+	for (const auto &[id, list] : _recent) {
+		for (const auto &reaction : list) {
+			result.push_back(reaction.peer->id.value);
+		}
+	}
+	ranges::sort(result);
+	result.erase(ranges::unique(result), end(result));
+	return result;
+}
+
+void MessageReactions::kgRecentChanged() {
+	_item->history()->kgItemReactorsChanged(_item);
 }
 // kg end
 
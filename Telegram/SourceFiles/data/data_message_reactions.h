@@ -133,6 +133,9 @@ public:
 
 	void poll(not_null<HistoryItem*> item, crl::time now);
 
+	// Both from the updates and from the polled reactions.
+	void applyUpdate(const MTPDupdateMessageReactions &data);
+
 	void updateAllInHistory(not_null<PeerData*> peer, bool enabled);
 
 	void clearTemporary();
@@ -233,6 +236,13 @@ private:
 
 	void repaintCollected();
 	void pollCollected();
+	void pollDone(not_null<PeerData*> peer, crl::time sent, bool changed);
+	[[nodiscard]] bool pollApply(const MTPUpdates &result);
+	[[nodiscard]] crl::time pollInterval(
+		not_null<PeerData*> peer,
+		crl::time now) const;
+	void pollSchedule();
+	void pollReportStats(crl::time now);
 
 	const not_null<Session*> _owner;
 
@@ -304,9 +314,22 @@ private:
 
 	base::flat_map<not_null<HistoryItem*>, crl::time> _repaintItems;
 	base::Timer _repaintTimer;
-	base::flat_set<not_null<HistoryItem*>> _pollItems;
-	base::flat_set<not_null<HistoryItem*>> _pollingItems;
-	mtpRequestId _pollRequestId = 0;
+	struct PollPeer {
+		base::flat_set<not_null<HistoryItem*>> items;
+		base::flat_set<not_null<HistoryItem*>> polling;
+		mtpRequestId requestId = 0;
+		crl::time activity = 0; // Last time polling found a change.
+	};
+	struct PollStats {
+		crl::time started = 0;
+		int requests = 0;
+		int items = 0;
+		crl::time ageTotal = 0; // Since the previous refresh of items.
+		crl::time ageMax = 0;
+	};
+	base::flat_map<not_null<PeerData*>, PollPeer> _pollPeers;
+	PollStats _pollStats;
+	bool _pollScheduled = false;
 
 	mtpRequestId _saveFaveRequestId = 0;
 
@@ -351,7 +374,11 @@ public:
 	[[nodiscard]] bool hasUnread() const;
 	void markRead();
 
-	void invalidateKgData() const; // kg
+	// kg begin
+	void invalidateKgData() const;
+	// Sorted ids of the recent reactors.
+	[[nodiscard]] std::vector<BareId> kgRecentReactors() const;
+	// kg end
 
 private:
 	const not_null<HistoryItem*> _item;
@@ -360,13 +387,26 @@ private:
 	base::flat_map<ReactionId, std::vector<RecentReaction>> _recent;
 
     // kg begin
-	mutable std::vector<MessageReaction> _kg_list;
-	mutable base::flat_map<ReactionId, std::vector<RecentReaction>> _kg_recent;
-	mutable bool _kg_data_is_actual = false;
+	// Materialized only when some recent reactor is actually blocked.
+	struct KgFiltered {
+		std::vector<MessageReaction> list;
+		base::flat_map<ReactionId, std::vector<RecentReaction>> recent;
+	};
+	[[nodiscard]] bool kgHidden(int index, const RecentReaction &r) const;
+	[[nodiscard]] int kgHiddenCount(const ReactionId &id) const;
 	void checkResetKgData() const;
+	void kgRecentChanged();
+	const KgFiltered &kgFiltered() const;
 	const std::vector<MessageReaction> &listForPublic() const;
 	auto recentForPublic() const
 		-> const base::flat_map<ReactionId, std::vector<RecentReaction>> &;
+
+	// Bit per _recent entry in iteration order, set for blocked reactors.
+	mutable uint64 _kg_hidden = 0;
+	mutable uint64 _kg_generation = 0;
+	mutable int _kg_hiddenCount = 0;
+	mutable bool _kg_hasUnread = false;
+	mutable std::unique_ptr<KgFiltered> _kg_filtered;
     // kg end
 };
 
@@ -109,6 +109,14 @@ using FilterId = int32;
 
 using MessageIdsList = std::vector<FullMsgId>;
 
+// kg - For hashed containers of message ids.
+struct FullMsgIdHash {
+	[[nodiscard]] size_t operator()(FullMsgId id) const {
+		return std::hash<uint64>()(id.peer.value)
+			^ std::hash<int64>()(id.msg.bare);
+	}
+};
+
 [[nodiscard]] PeerId PeerFromMessage(const MTPmessage &message);
 [[nodiscard]] BareId AuthorIDFromMessage(const MTPmessage &message); // kg
 [[nodiscard]] MTPDmessage::Flags FlagsFromMessage(
@@ -324,6 +332,9 @@ enum class MessageFlag : uint64 {
 	ShortcutMessage       = (1ULL << 44),
 
 	EffectWatched         = (1ULL << 45),
+
+	// kg - Tombstone of a blocked author's message, only id and date kept.
+	KgDropped             = (1ULL << 46),
 };
 inline constexpr bool is_flag_type(MessageFlag) { return true; }
 using MessageFlags = base::flags<MessageFlag>;
@@ -738,7 +738,9 @@ void RowPainter::Paint(
 	const auto peer = history ? history->peer.get() : nullptr;
 	const auto badgesState = entry->chatListBadgesState();
 	entry->chatListPreloadData(); // Allow chat list message resolve.
-	const auto item = entry->chatListMessage();
+	const auto item = history
+		? history->kgChatListMessage() // kg
+		: entry->chatListMessage();
 	const auto cloudDraft = [&]() -> const Data::Draft*{
 		if (!thread) {
 			return nullptr;
@@ -957,9 +959,7 @@ void RowPainter::Paint(
     // kg - for search result item from blocked user
     const auto paintBackgroundOnly = row->searchInChat()
 	    && item
-	    && item->from()
-	    && history
-	    && history->session().kgModeAndUserIsBlocked(item->from().get()->id.value);
+	    && item->kgHiddenFromBlocked();
 	PaintRow(
 		p,
 		row,
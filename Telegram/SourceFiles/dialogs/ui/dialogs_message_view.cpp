@@ -315,7 +315,7 @@ void MessageView::paint(
 	const auto pausedSpoiler = context.paused
 		|| On(PowerSaving::kChatSpoiler);
 
-    if (_textCachedFor && !_textCachedFor->history()->session().kgModeAndUserIsBlocked(_textCachedFor->from().get()->id.value)) { // kg
+    if (_textCachedFor && !_textCachedFor->kgHiddenFromBlocked()) { // kg
 
 	if (!_senderCache.isEmpty()) {
 		_senderCache.draw(p, {
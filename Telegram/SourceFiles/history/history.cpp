@@ -48,6 +48,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "apiwrap.h"
 #include "api/api_chat_participants.h"
 #include "api/api_unread_things.h" // kg
+#include "api/api_updates_dispatcher.h"
 #include "mainwidget.h"
 #include "mainwindow.h"
 #include "main/main_session.h"
@@ -70,13 +71,46 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "base/qt/qt_common_adapters.h"
 #include "styles/style_dialogs.h"
 
+#include <bit>
+
 namespace {
 
 constexpr auto kNewBlockEachMessage = 50;
 constexpr auto kSkipCloudDraftsFor = TimeId(2);
+constexpr auto kEstimateViewBytes = 512;
+constexpr auto kEstimateTextCharBytes = 2 * int64(sizeof(QChar)); // Layout.
+constexpr auto kKgLastVisibleScanLimit = 200; // kg
+constexpr auto kKgLastVisiblePages = 3; // kg
 
 using UpdateFlag = Data::HistoryUpdate::Flag;
 
+// Incoming messages and outgoing ones sent from scheduled, the same
+// messages that newItemAdded() counts as unread.
+[[nodiscard]] bool CountsAsUnread(not_null<HistoryItem*> item) {
+	return item->isRegular() && (!item->out() || item->isFromScheduled());
+}
+
+// kg - Scheduled, sponsored, local or shortcut messages are never
+// shown as the chat list message, scheduled ones would win by date.
+[[nodiscard]] bool KgCountsForLastVisible(not_null<HistoryItem*> item) {
+	return item->isHistoryEntry() && item->isRegular();
+}
+
+void RemoveFromIndex( // kg
+		std::unordered_map<
+			BareId,
+			std::unordered_set<not_null<HistoryItem*>>> &index,
+		BareId id,
+		not_null<HistoryItem*> item) {
+	const auto i = index.find(id);
+	if (i != end(index)) {
+		i->second.erase(item);
+		if (i->second.empty()) {
+			index.erase(i);
+		}
+	}
+}
+
 [[nodiscard]] HistoryItemCommonFields WithLocalFlag(
 		HistoryItemCommonFields fields) {
 	fields.flags |= MessageFlag::Local;
@@ -85,6 +119,54 @@ using UpdateFlag = Data::HistoryUpdate::Flag;
 
 } // namespace
 
+void HistoryUnreadCandidates::insert(not_null<HistoryItem*> item) {
+	const auto id = item->id;
+	const auto i = ranges::lower_bound(_list, id, ranges::less(), &Entry::id);
+	if (i != end(_list) && i->id == id) {
+		return;
+	}
+	_list.insert(i, Entry{ id, item });
+	if (!item->out()) {
+		_incoming.insert(ranges::lower_bound(_incoming, id), id);
+	}
+}
+
+void HistoryUnreadCandidates::remove(not_null<HistoryItem*> item) {
+	const auto id = item->id;
+	const auto i = ranges::lower_bound(_list, id, ranges::less(), &Entry::id);
+	if (i == end(_list) || i->item != item) {
+		return;
+	}
+	_list.erase(i);
+	if (!item->out()) {
+		const auto j = ranges::lower_bound(_incoming, id);
+		Assert(j != end(_incoming) && *j == id);
+		_incoming.erase(j);
+	}
+}
+
+void HistoryUnreadCandidates::clear() {
+	_list.clear();
+	_incoming.clear();
+}
+
+auto HistoryUnreadCandidates::from(MsgId id) const
+-> ranges::subrange<std::vector<Entry>::const_iterator> {
+	return ranges::make_subrange(
+		ranges::lower_bound(_list, id, ranges::less(), &Entry::id),
+		end(_list));
+}
+
+int HistoryUnreadCandidates::count(MsgId from, MsgId till) const {
+	const auto i = ranges::lower_bound(_list, from, ranges::less(), &Entry::id);
+	const auto j = ranges::upper_bound(_list, till, ranges::less(), &Entry::id);
+	return std::max(int(j - i), 0);
+}
+
+int HistoryUnreadCandidates::countIncomingAfter(MsgId id) const {
+	return int(end(_incoming) - ranges::upper_bound(_incoming, id));
+}
+
 History::History(not_null<Data::Session*> owner, PeerId peerId)
 : Thread(owner, Type::History)
 , peer(owner->peer(peerId))
@@ -93,6 +175,9 @@ History::History(not_null<Data::Session*> owner, PeerId peerId)
 , _sendActionPainter(this) {
 	Thread::setMuted(owner->notifySettings().isMuted(peer));
 
+	// Items are indexed with the current blocked list.
+	_kgUnreadGeneration = owner->session().blockedPeersGeneration(); // kg
+
 	if (const auto user = peer->asUser()) {
 		if (user->isBot()) {
 			_outboxReadBefore = std::numeric_limits<MsgId>::max();
@@ -435,7 +520,11 @@ not_null<HistoryItem*> History::createItem(
 		}
 		return result;
 	}
-	const auto result = message.match([&](const auto &data) {
+	const auto result = message.match([&](const MTPDmessage &data) {
+		return kgShouldDrop(data) // kg
+			? makeMessage(id, data, localFlags, HistoryItem::KgDroppedTag())
+			: makeMessage(id, data, localFlags);
+	}, [&](const auto &data) {
 		return makeMessage(id, data, localFlags);
 	});
 	if (newMessage && result->out() && result->isRegular()) {
@@ -491,6 +580,7 @@ not_null<HistoryItem*> History::insertItem(
 
 	const auto result = i->get();
 	owner().registerMessage(result);
+	kgIndexItem(result); // kg
 
 	Ensures(ok);
 	return result;
@@ -529,6 +619,7 @@ void History::destroyMessage(not_null<HistoryItem*> item) {
 
 	owner().unregisterMessage(item);
 	Core::App().notifications().clearFromItem(item);
+	kgUnindexItem(item); // kg
 
 	auto hack = std::unique_ptr<HistoryItem>(item.get());
 	const auto i = _items.find(hack);
@@ -542,6 +633,22 @@ void History::destroyMessage(not_null<HistoryItem*> item) {
 	}
 }
 
+void History::viewCreated() {
+	_viewsMemory += kEstimateViewBytes;
+}
+
+void History::viewDestroyed(int textLength) {
+	_viewsMemory -= kEstimateViewBytes + kEstimateTextCharBytes * textLength;
+
+	Ensures(_viewsMemory >= 0);
+}
+
+void History::viewTextChanged(int wasLength, int nowLength) {
+	_viewsMemory += kEstimateTextCharBytes * int64(nowLength - wasLength);
+
+	Ensures(_viewsMemory >= 0);
+}
+
 void History::destroyMessagesByDates(TimeId minDate, TimeId maxDate) {
 	auto toDestroy = std::vector<not_null<HistoryItem*>>();
 	toDestroy.reserve(_items.size());
@@ -1205,6 +1312,9 @@ void History::newItemAdded(not_null<HistoryItem*> item) {
 		if (from == item->author()) {
 			_sendActionPainter.clear(from);
 			owner().sendActionManager().repliesPaintersClear(this, from);
+			session().updatesDispatcher().typing().messageReceived(
+				peer->id,
+				from->id);
 		}
 		from->madeAction(item->date());
 	}
@@ -1239,7 +1349,7 @@ void History::newItemAdded(not_null<HistoryItem*> item) {
 		}
 	} else {
 		if (item->unread(this)) {
-			if (!session().kgModeAndUserIsBlocked(item->from().get()->id.value)) { // kg
+			if (!item->kgHiddenFromBlocked()) { // kg
 			// kg - avoid increment chat unreadCount on new message from blocked user
 			if (unreadCountKnown()) {
 				setUnreadCount(unreadCount() + 1);
@@ -1583,20 +1693,33 @@ void History::calculateFirstUnreadMessage() {
 	if (!unreadCount() || !trackUnreadMessages()) {
 		return;
 	}
-	for (const auto &block : ranges::views::reverse(blocks)) {
-		for (const auto &message : ranges::views::reverse(block->messages)) {
-			const auto item = message->data();
-			if (!item->isRegular()) {
-				continue;
-			} else if (!item->out()) {
-				if (item->id >= *_inboxReadBefore) {
-					_firstUnreadView = message.get();
-				} else {
-					return;
-				}
+	const auto &candidates = unreadCandidates();
+	for (const auto &[id, item] : candidates.from(*_inboxReadBefore)) {
+		if (item->out()) {
+			continue;
+		} else if (const auto view = item->mainView()) {
+			_firstUnreadView = view;
+			return;
+		}
+	}
+}
+
+const HistoryUnreadCandidates &History::unreadCandidates() const {
+	// kg - messages from blocked authors are not unread in KG mode.
+	if (!session().kgMode()) {
+		return _unreadCandidates;
+	}
+	const auto generation = session().blockedPeersGeneration();
+	if (_kgUnreadGeneration != generation) {
+		_kgUnreadGeneration = generation;
+		_kgUnreadCandidates.clear();
+		for (const auto &[id, item] : _unreadCandidates.list()) {
+			if (!item->kgFromBlocked()) {
+				_kgUnreadCandidates.insert(item);
 			}
 		}
 	}
+	return _kgUnreadCandidates;
 }
 
 bool History::readInboxTillNeedsRequest(MsgId tillId) {
@@ -1638,20 +1761,9 @@ std::optional<int> History::countStillUnreadLocal(MsgId readTillId) const {
 			).arg(minMsgId().bare
 			).arg(maxMsgId().bare));
 		if (minMsgId() <= before && maxMsgId() >= readTillId) {
-			auto result = 0;
-			for (const auto &block : blocks) {
-				for (const auto &message : block->messages) {
-					const auto item = message->data();
-					if (!item->isRegular()
-						|| (item->out() && !item->isFromScheduled())) {
-						continue;
-					} else if (item->id > readTillId) {
-						break;
-					} else if (item->id >= before) {
-						++result;
-					}
-				}
-			}
+			const auto result = unreadCandidates().count(
+				before,
+				readTillId);
 			DEBUG_LOG(("Reading: check before result %1 with existing %2"
 				).arg(result
 				).arg(_unreadCount.value_or(-666)));
@@ -1670,19 +1782,7 @@ std::optional<int> History::countStillUnreadLocal(MsgId readTillId) const {
 		|| minimalServerId > readTillId) {
 		return std::nullopt;
 	}
-	auto result = 0;
-	for (const auto &block : ranges::views::reverse(blocks)) {
-		for (const auto &message : ranges::views::reverse(block->messages)) {
-			const auto item = message->data();
-			if (item->isRegular()) {
-				if (item->id <= readTillId) {
-					return result;
-				} else if (!item->out()) {
-					++result;
-				}
-			}
-		}
-	}
+	const auto result = unreadCandidates().countIncomingAfter(readTillId);
 	DEBUG_LOG(("Reading: check at end counted %1").arg(result));
 	return result;
 }
@@ -1776,29 +1876,299 @@ HistoryItem *History::lastAvailableMessage() const {
 }
 
 // kg begin
-// HistoryItem *History::lastAvailableMessageFromNonBlockedUser() const {
-// 	for (int blocksIndex = blocks.size() - 1; blocksIndex >= 0; blocksIndex--) {
-// 		for (int messagesIndex = blocks[blocksIndex]->messages.size() - 1; messagesIndex >= 0; messagesIndex--) {
-// 			HistoryItem *item = blocks[blocksIndex]->messages[messagesIndex].get()->data().get();
-// 			if (session().kgModeAndUserIsBlocked(item->from().get()->id.value)) continue;
-
-// 			return item;
-// 		}
-// 	}
-// 	return nullptr;
-// }
+HistoryItem *History::kgChatListMessage() {
+	const auto item = chatListMessage();
+	if (!item || !item->kgHiddenFromBlocked()) {
+		return item;
+	}
+	if (_kgLastVisible
+		&& *_kgLastVisible
+		&& (*_kgLastVisible)->kgFromBlocked()) {
+		// The author was blocked after we remembered the item.
+		_kgLastVisible = std::nullopt;
+	}
+	if (!_kgLastVisible) {
+		kgFindLastVisible();
+	}
+	return _kgLastVisible.value_or(nullptr);
+}
+
+void History::kgFindLastVisible() {
+	Expects(!_kgLastVisible.has_value());
+
+	const auto last = chatListMessage();
+	auto offsetId = last ? last->id : MsgId();
+	auto scanned = 0;
+	if (loadedAtBottom()) {
+		for (const auto &block : ranges::views::reverse(blocks)) {
+			const auto &messages = block->messages;
+			for (const auto &view : ranges::views::reverse(messages)) {
+				const auto item = view->data();
+				if (!KgCountsForLastVisible(item)) {
+					continue;
+				} else if (!item->kgFromBlocked()) {
+					_kgLastVisible = item.get();
+					return;
+				}
+				offsetId = item->id;
+				if (++scanned == kKgLastVisibleScanLimit) {
+					break;
+				}
+			}
+			if (scanned == kKgLastVisibleScanLimit) {
+				break;
+			}
+		}
+		if (loadedAtTop() && scanned < kKgLastVisibleScanLimit) {
+			_kgLastVisible = nullptr;
+			return;
+		}
+	}
+	owner().histories().kgRequestLastVisible(
+		this,
+		offsetId,
+		kKgLastVisiblePages);
+}
+
+void History::kgSetLastVisibleFrom(
+		const MTPmessages_Messages &data,
+		int pagesLeft) {
+	if (_kgLastVisible) {
+		// Found by a local scan of a slice loaded meanwhile.
+		return;
+	}
+	auto found = (HistoryItem*)nullptr;
+	auto offsetId = MsgId();
+	data.match([&](const MTPDmessages_messagesNotModified &) {
+	}, [&](const auto &data) {
+		owner().processUsers(data.vusers());
+		owner().processChats(data.vchats());
+		for (const auto &message : data.vmessages().v) {
+			const auto item = owner().addNewMessage(
+				message,
+				MessageFlags(),
+				NewMessageType::Existing);
+			if (!item || item->history() != this) {
+				continue;
+			}
+			offsetId = item->id;
+			if (!item->kgFromBlocked()) {
+				found = item;
+				break;
+			}
+		}
+	});
+	if (found) {
+		_kgLastVisible = found;
+	} else if (!offsetId || pagesLeft <= 1) {
+		_kgLastVisible = nullptr;
+	} else {
+		owner().histories().kgRequestLastVisible(
+			this,
+			offsetId,
+			pagesLeft - 1);
+		return;
+	}
+	updateChatListEntry();
+}
+
+void History::kgResetLastVisible() {
+	if (_kgLastVisible) {
+		_kgLastVisible = std::nullopt;
+		updateChatListEntry();
+	}
+}
+
+void History::kgIndexItem(not_null<HistoryItem*> item) {
+	_kgItemsByAuthor[item->from()->id.value].emplace(item);
+	if (item->kgDropped()) {
+		++_kgDroppedCount;
+	}
+	if (CountsAsUnread(item)) {
+		_unreadCandidates.insert(item);
+		if (_kgUnreadGeneration == session().blockedPeersGeneration()
+			&& !item->kgFromBlocked()) {
+			_kgUnreadCandidates.insert(item);
+		}
+	}
+
+	// Both new and loaded items pass here, keep the newest visible one.
+	if (!_kgLastVisible
+		|| !KgCountsForLastVisible(item)
+		|| item->kgFromBlocked()) {
+		return;
+	} else if (const auto was = *_kgLastVisible) {
+		if (was->date() > item->date()
+			|| (was->date() == item->date() && was->id > item->id)) {
+			return;
+		}
+	}
+	_kgLastVisible = item.get();
+}
+
+void History::kgUnindexItem(not_null<HistoryItem*> item) {
+	RemoveFromIndex(_kgItemsByAuthor, item->from()->id.value, item);
+	const auto i = _kgReactorsByItem.find(item);
+	if (i != end(_kgReactorsByItem)) {
+		for (const auto reactorId : i->second) {
+			RemoveFromIndex(_kgItemsByReactor, reactorId, item);
+		}
+		_kgReactorsByItem.erase(i);
+	}
+	if (item->kgDropped()) {
+		--_kgDroppedCount;
+	}
+	if (_kgLastVisible == item.get()) {
+		_kgLastVisible = std::nullopt;
+	}
+	_unreadCandidates.remove(item);
+	_kgUnreadCandidates.remove(item);
+}
+
+void History::kgItemReactorsChanged(not_null<HistoryItem*> item) {
+	auto now = item->kgRecentReactors();
+	auto &was = _kgReactorsByItem[item];
+	for (const auto reactorId : was) {
+		if (!ranges::binary_search(now, reactorId)) {
+			RemoveFromIndex(_kgItemsByReactor, reactorId, item);
+		}
+	}
+	for (const auto reactorId : now) {
+		if (!ranges::binary_search(was, reactorId)) {
+			_kgItemsByReactor[reactorId].emplace(item);
+		}
+	}
+	if (now.empty()) {
+		_kgReactorsByItem.erase(item);
+	} else {
+		was = std::move(now);
+	}
+}
+
+void History::kgRefreshItem(
+		not_null<HistoryItem*> item,
+		bool invalidateKgData) {
+	if (!item->isRegular()) {
+		return;
+	} else if (invalidateKgData) {
+		item->invalidateKgData();
+	}
+
+	// Items without a view will be laid out when they are shown.
+	if (item->mainView()) {
+		owner().histories().kgScheduleRelayout(item);
+	}
+}
 
 void History::kgRefreshAll(bool invalidateKgData) {
-	for (const auto &item : _items) {
-		if (!item->isRegular()) continue;
-		if (invalidateKgData) {
-			item->invalidateKgData();
+	const auto &blocked = session().blockedPeers();
+	for (const auto &[authorId, items] : _kgItemsByAuthor) {
+		if (blocked.contains(authorId)) {
+			for (const auto &item : items) {
+				kgRefreshItem(item, invalidateKgData);
+			}
+		}
+	}
+	for (const auto &[reactorId, items] : _kgItemsByReactor) {
+		if (blocked.contains(reactorId)) {
+			for (const auto &item : items) {
+				kgRefreshItem(item, invalidateKgData);
+			}
 		}
-		const auto nn_item = not_null(item.get());
-		owner().notifyItemDataChange(nn_item);
-		owner().requestItemResize(nn_item);
 	}
+	kgResetLastVisible();
 
+	if (_kgDroppedCount
+		&& (!session().kgMode() || !session().kgDropBlocked())) {
+		auto dropped = std::vector<not_null<HistoryItem*>>();
+		dropped.reserve(_kgDroppedCount);
+		for (const auto &[authorId, items] : _kgItemsByAuthor) {
+			for (const auto &item : items) {
+				if (item->kgDropped()) {
+					dropped.push_back(item);
+				}
+			}
+		}
+		kgReloadDropped(std::move(dropped));
+	}
+}
+
+void History::kgRefreshAuthor(BareId authorId) {
+	auto dropped = std::vector<not_null<HistoryItem*>>();
+	const auto i = _kgItemsByAuthor.find(authorId);
+	if (i != end(_kgItemsByAuthor)) {
+		for (const auto &item : i->second) {
+			if (item->kgDropped()) {
+				dropped.push_back(item);
+			}
+			kgRefreshItem(item, true);
+		}
+		kgResetLastVisible();
+	}
+	const auto j = _kgItemsByReactor.find(authorId);
+	if (j != end(_kgItemsByReactor)) {
+		for (const auto &item : j->second) {
+			kgRefreshItem(item, true);
+		}
+	}
+	if (!session().userIsBlocked(authorId)) {
+		kgReloadDropped(std::move(dropped));
+	}
+}
+
+bool History::kgShouldDrop(const MTPDmessage &data) const {
+	if (!session().kgMode()
+		|| !session().kgDropBlocked()
+		|| peer->isUser()
+		|| data.is_out()) {
+		return false;
+	}
+	const auto from = data.vfrom_id();
+	return from && session().userIsBlocked(peerFromMTP(*from).value);
+}
+
+void History::kgReloadDropped(std::vector<not_null<HistoryItem*>> dropped) {
+	auto ids = std::vector<MsgId>();
+	ids.reserve(dropped.size());
+	for (const auto &item : dropped) {
+		if (item->isRegular()) {
+			ids.push_back(item->id);
+		}
+	}
+	if (!ids.empty()) {
+		owner().histories().kgRequestDropped(this, std::move(ids));
+	}
+}
+
+void History::kgReplaceDropped(const MTPmessages_Messages &data) {
+	data.match([&](const MTPDmessages_messagesNotModified &) {
+	}, [&](const auto &data) {
+		owner().processUsers(data.vusers());
+		owner().processChats(data.vchats());
+		for (const auto &message : data.vmessages().v) {
+			const auto id = IdFromMessage(message);
+			const auto tombstone = owner().message(peer, id);
+			if (!tombstone || !tombstone->kgDropped()) {
+				continue;
+			}
+			// Tombstones can't become messages again, so each one is
+			// destroyed and the message takes its place in the blocks.
+			const auto shown = (tombstone->mainView() != nullptr);
+			tombstone->destroy();
+			if (message.type() == mtpc_messageEmpty) {
+				continue;
+			}
+			const auto item = createItem(
+				id,
+				message,
+				MessageFlags(),
+				false, // detachExistingItem
+				false); // newMessage
+			if (shown && !item->mainView()) {
+				insertMessageToBlocks(item);
+			}
+		}
+	});
 }
 // kg end
 
@@ -2066,50 +2436,32 @@ auto History::findScrollTopItem(int top) const -> Element* {
 		return nullptr;
 	}
 
-	auto itemIndex = 0;
-	auto blockIndex = 0;
-	auto itemTop = 0;
-	if (scrollTopItem) {
-		itemIndex = scrollTopItem->indexInBlock();
-		blockIndex = scrollTopItem->block()->indexInHistory();
-		itemTop = blocks[blockIndex]->y() + scrollTopItem->y();
-	}
-	if (itemTop > top) {
-		// go backward through history while we don't find an item that starts above
-		do {
-			const auto &block = blocks[blockIndex];
-			for (--itemIndex; itemIndex >= 0; --itemIndex) {
-				const auto view = block->messages[itemIndex].get();
-				itemTop = block->y() + view->y();
-				if (itemTop <= top) {
-					return view;
-				}
-			}
-			if (--blockIndex >= 0) {
-				itemIndex = blocks[blockIndex]->messages.size();
-			} else {
-				break;
-			}
-		} while (true);
-
+	// Block tops and item tops inside a block are prefix sums of heights,
+	// so we find the last item that starts above 'top' by bisection.
+	const auto blockTop = [](const std::unique_ptr<HistoryBlock> &block) {
+		return block->y();
+	};
+	const auto blockAfter = ranges::upper_bound(
+		blocks,
+		top,
+		ranges::less(),
+		blockTop);
+	if (blockAfter == begin(blocks)) {
 		return blocks.front()->messages.front().get();
 	}
-	// go forward through history while we don't find the last item that starts above
-	for (auto blocksCount = int(blocks.size()); blockIndex < blocksCount; ++blockIndex) {
-		const auto &block = blocks[blockIndex];
-		for (auto itemsCount = int(block->messages.size()); itemIndex < itemsCount; ++itemIndex) {
-			itemTop = block->y() + block->messages[itemIndex]->y();
-			if (itemTop > top) {
-				Assert(itemIndex > 0 || blockIndex > 0);
-				if (itemIndex > 0) {
-					return block->messages[itemIndex - 1].get();
-				}
-				return blocks[blockIndex - 1]->messages.back().get();
-			}
-		}
-		itemIndex = 0;
-	}
-	return blocks.back()->messages.back().get();
+	const auto &block = *(blockAfter - 1);
+	const auto &messages = block->messages;
+	const auto itemTop = [](const std::unique_ptr<Element> &view) {
+		return view->y();
+	};
+	const auto itemAfter = ranges::upper_bound(
+		messages,
+		top - block->y(),
+		ranges::less(),
+		itemTop);
+	return (itemAfter == begin(messages))
+		? messages.front().get()
+		: (itemAfter - 1)->get();
 }
 
 void History::getNextScrollTopItem(HistoryBlock *block, int32 i) {
@@ -2311,6 +2663,7 @@ const base::flat_set<QChar> &History::chatListFirstLetters() const {
 }
 
 void History::chatListPreloadData() {
+	_chatListPaintedAt = crl::now();
 	peer->loadUserpic();
 	allowChatListMessageResolve();
 }
@@ -3351,10 +3704,8 @@ auto History::findFirstNonEmpty() const -> Element* {
 
 auto History::findFirstDisplayed() const -> Element* {
 	for (const auto &block : blocks) {
-		for (const auto &element : block->messages) {
-			if (!element->data()->isEmpty() && !element->isHidden()) {
-				return element.get();
-			}
+		if (const auto result = block->firstDisplayed(true)) {
+			return result;
 		}
 	}
 	return nullptr;
@@ -3373,10 +3724,8 @@ auto History::findLastNonEmpty() const -> Element* {
 
 auto History::findLastDisplayed() const -> Element* {
 	for (const auto &block : ranges::views::reverse(blocks)) {
-		for (const auto &element : ranges::views::reverse(block->messages)) {
-			if (!element->data()->isEmpty() && !element->isHidden()) {
-				return element.get();
-			}
+		if (const auto result = block->lastDisplayed(true)) {
+			return result;
 		}
 	}
 	return nullptr;
@@ -3611,14 +3960,18 @@ int HistoryBlock::resizeGetHeight(int newWidth, ResizeRequest request) {
 			message->setY(y);
 			y += message->resizeGetHeight(newWidth);
 		}
-	} else {
+	} else if (_hasPendingResize) {
 		for (const auto &message : messages) {
 			message->setY(y);
 			y += message->pendingResize()
 				? message->resizeGetHeight(newWidth)
 				: message->height();
 		}
+	} else {
+		// Nothing has changed inside, only the block top may move.
+		return _height;
 	}
+	_hasPendingResize = false;
 	_height = y;
 	return _height;
 }
@@ -3633,6 +3986,8 @@ void HistoryBlock::remove(not_null<Element*> view) {
 	const auto item = view->data();
 	item->clearMainView();
 	messages.erase(messages.begin() + itemIndex);
+	_hasPendingResize = true;
+	invalidateDisplayed();
 	for (auto i = itemIndex, l = int(messages.size()); i < l; ++i) {
 		messages[i]->setIndexInBlock(i);
 	}
@@ -3671,4 +4026,81 @@ void HistoryBlock::refreshView(not_null<Element*> view) {
 	}
 }
 
+void HistoryBlock::refreshDisplayed() const {
+	const auto count = int(messages.size());
+	const auto words = (count + 63) / 64;
+	_displayed.assign(words, 0);
+	_displayedNotKgHidden.assign(words, 0);
+	for (auto i = 0; i != count; ++i) {
+		const auto &view = messages[i];
+		if (view->data()->isEmpty() || view->isHiddenByGroup()) {
+			continue;
+		}
+		const auto bit = uint64(1) << (i & 63);
+		_displayed[i >> 6] |= bit;
+		if (!view->data()->kgHiddenFromBlocked()) {
+			_displayedNotKgHidden[i >> 6] |= bit;
+		}
+	}
+	_displayedValid = true;
+}
+
+uint64 HistoryBlock::displayedKgStamp() const {
+	const auto &session = _history->session();
+	return (session.blockedPeersGeneration() << 1)
+		| (session.kgMode() ? 1 : 0);
+}
+
+const std::vector<uint64> &HistoryBlock::displayed(bool skipKgHidden) const {
+	const auto stamp = displayedKgStamp();
+	if (!_displayedValid || _displayedKgStamp != stamp) {
+		_displayedKgStamp = stamp;
+		refreshDisplayed();
+	}
+	return skipKgHidden ? _displayedNotKgHidden : _displayed;
+}
+
+auto HistoryBlock::firstDisplayed(bool skipKgHidden) const -> Element* {
+	return displayedAfter(-1, skipKgHidden);
+}
+
+auto HistoryBlock::lastDisplayed(bool skipKgHidden) const -> Element* {
+	return displayedBefore(int(messages.size()), skipKgHidden);
+}
+
+auto HistoryBlock::displayedAfter(int index, bool skipKgHidden) const
+-> Element* {
+	const auto &bits = displayed(skipKgHidden);
+	const auto from = index + 1;
+	for (auto word = from >> 6; word < int(bits.size()); ++word) {
+		auto value = bits[word];
+		if (word == (from >> 6)) {
+			value &= ~uint64(0) << (from & 63);
+		}
+		if (value) {
+			return messages[(word << 6) + std::countr_zero(value)].get();
+		}
+	}
+	return nullptr;
+}
+
+auto HistoryBlock::displayedBefore(int index, bool skipKgHidden) const
+-> Element* {
+	const auto &bits = displayed(skipKgHidden);
+	if (index <= 0) {
+		return nullptr;
+	}
+	const auto till = index - 1;
+	for (auto word = till >> 6; word >= 0; --word) {
+		auto value = bits[word];
+		if (word == (till >> 6) && (till & 63) != 63) {
+			value &= (uint64(1) << ((till & 63) + 1)) - 1;
+		}
+		if (value) {
+			return messages[(word << 6) + 63 - std::countl_zero(value)].get();
+		}
+	}
+	return nullptr;
+}
+
 HistoryBlock::~HistoryBlock() = default;
@@ -12,6 +12,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "data/data_drafts.h"
 #include "data/data_thread.h"
 #include "history/view/history_view_send_action.h"
+#include "history/history_item_slab.h"
 #include "base/variant.h"
 #include "base/flat_set.h"
 #include "base/flags.h"
@@ -74,6 +75,38 @@ enum class NewMessageType {
 	Existing,
 };
 
+// Loaded messages that may count as unread, read ones included.
+// Sorted vectors, so that counts in an id range are differences of
+// lower_bound / upper_bound indices. Slices are loaded in id order,
+// so inserts mostly land at one of the ends.
+class HistoryUnreadCandidates final {
+public:
+	struct Entry {
+		MsgId id = 0;
+		not_null<HistoryItem*> item;
+	};
+
+	void insert(not_null<HistoryItem*> item);
+	void remove(not_null<HistoryItem*> item);
+	void clear();
+
+	// Entries with id >= from, for the first unread lookup.
+	[[nodiscard]] auto from(MsgId id) const
+		-> ranges::subrange<std::vector<Entry>::const_iterator>;
+
+	[[nodiscard]] int count(MsgId from, MsgId till) const;
+	[[nodiscard]] int countIncomingAfter(MsgId id) const;
+
+	[[nodiscard]] const std::vector<Entry> &list() const {
+		return _list;
+	}
+
+private:
+	std::vector<Entry> _list;
+	std::vector<MsgId> _incoming; // Ids of the not out() ones.
+
+};
+
 class History final : public Data::Thread {
 public:
 	using Element = HistoryView::Element;
@@ -131,25 +164,35 @@ public:
 
 	template <typename ...Args>
 	not_null<HistoryItem*> makeMessage(MsgId id, Args &&...args) {
-		return static_cast<HistoryItem*>(
-			insertItem(
-				std::make_unique<HistoryItem>(
-					this,
-					id,
-					std::forward<Args>(args)...)).get());
+		return insertItem(std::unique_ptr<HistoryItem>(
+			new (_itemsSlab) HistoryItem(
+				this,
+				id,
+				std::forward<Args>(args)...)));
 	}
 	template <typename ...Args>
 	not_null<HistoryItem*> makeMessage(
 			HistoryItemCommonFields &&fields,
 			Args &&...args) {
-		return static_cast<HistoryItem*>(
-			insertItem(
-				std::make_unique<HistoryItem>(
-					this,
-					std::move(fields),
-					std::forward<Args>(args)...)).get());
+		return insertItem(std::unique_ptr<HistoryItem>(
+			new (_itemsSlab) HistoryItem(
+				this,
+				std::move(fields),
+				std::forward<Args>(args)...)));
+	}
+	[[nodiscard]] const HistoryItemSlab::Stats &itemsAllocationStats() const {
+		return _itemsSlab.stats();
 	}
 
+	// Rough size of what ClearType::Unload frees: the views in blocks
+	// with their text layouts. Kept up to date by the views themselves.
+	[[nodiscard]] int64 memoryEstimate() const {
+		return _viewsMemory;
+	}
+	void viewCreated();
+	void viewDestroyed(int textLength);
+	void viewTextChanged(int wasLength, int nowLength);
+
 	void destroyMessage(not_null<HistoryItem*> item);
 	void destroyMessagesByDates(TimeId minDate, TimeId maxDate);
 	void destroyMessagesByTopic(MsgId topicRootId);
@@ -229,8 +272,17 @@ public:
 	[[nodiscard]] int unreadCount() const;
 	[[nodiscard]] bool unreadCountKnown() const;
 
-	// HistoryItem *lastAvailableMessageFromNonBlockedUser() const; // kg
-	void kgRefreshAll(bool invalidateKgData); // kg
+	// kg begin
+	// Chat list message with blocked authors skipped in KG mode.
+	[[nodiscard]] HistoryItem *kgChatListMessage();
+	void kgSetLastVisibleFrom(
+		const MTPmessages_Messages &data,
+		int pagesLeft);
+	void kgReplaceDropped(const MTPmessages_Messages &data);
+	void kgRefreshAll(bool invalidateKgData);
+	void kgRefreshAuthor(BareId authorId);
+	void kgItemReactorsChanged(not_null<HistoryItem*> item);
+	// kg end
 
 	// Some old unread count is known, but we read history till some place.
 	[[nodiscard]] bool unreadCountRefreshNeeded(MsgId readTillId) const;
@@ -378,6 +430,9 @@ public:
 	const base::flat_set<QString> &chatListNameWords() const override;
 	const base::flat_set<QChar> &chatListFirstLetters() const override;
 	void chatListPreloadData() override;
+	[[nodiscard]] crl::time chatListPaintedAt() const {
+		return _chatListPaintedAt;
+	}
 	void paintUserpic(
 		Painter &p,
 		Ui::PeerUserpicView &view,
@@ -569,6 +624,18 @@ private:
 
 	void createLocalDraftFromCloud(MsgId topicRootId);
 
+	[[nodiscard]] const HistoryUnreadCandidates &unreadCandidates() const;
+
+	// kg begin
+	void kgIndexItem(not_null<HistoryItem*> item);
+	void kgUnindexItem(not_null<HistoryItem*> item);
+	void kgRefreshItem(not_null<HistoryItem*> item, bool invalidateKgData);
+	void kgFindLastVisible();
+	void kgResetLastVisible();
+	[[nodiscard]] bool kgShouldDrop(const MTPDmessage &data) const;
+	void kgReloadDropped(std::vector<not_null<HistoryItem*>> dropped);
+	// kg end
+
 	HistoryItem *insertJoinedMessage();
 	void insertMessageToBlocks(not_null<HistoryItem*> item);
 
@@ -600,7 +667,36 @@ private:
 	std::optional<HistoryItem*> _lastMessage;
 	std::optional<HistoryItem*> _lastServerMessage;
 	base::flat_set<not_null<HistoryItem*>> _clientSideMessages;
+	HistoryItemSlab _itemsSlab; // Must outlive _items.
 	std::unordered_set<std::unique_ptr<HistoryItem>> _items;
+	int64 _viewsMemory = 0;
+
+	// kg begin
+	// Loaded items by author and by recent reactor, so that a change
+	// of the blocked list touches only the items it can affect.
+	std::unordered_map<
+		BareId,
+		std::unordered_set<not_null<HistoryItem*>>> _kgItemsByAuthor;
+	std::unordered_map<
+		BareId,
+		std::unordered_set<not_null<HistoryItem*>>> _kgItemsByReactor;
+	std::unordered_map<
+		not_null<HistoryItem*>,
+		std::vector<BareId>> _kgReactorsByItem; // Sorted.
+
+	// The second one skips messages from blocked authors, it is rebuilt
+	// in unreadCandidates() when the blocked list has changed.
+	HistoryUnreadCandidates _unreadCandidates;
+	mutable HistoryUnreadCandidates _kgUnreadCandidates;
+	mutable uint64 _kgUnreadGeneration = 0; // Blocked list of the rebuild.
+
+	// Newest known item from a non-blocked author, nullptr if there is
+	// none, std::nullopt if it should be looked up again.
+	std::optional<HistoryItem*> _kgLastVisible;
+
+	// Loaded tombstones, see HistoryItem::kgDropped().
+	int _kgDroppedCount = 0;
+	// kg end
 
 	std::unique_ptr<Data::HistoryMessages> _messages;
 
@@ -610,6 +706,7 @@ private:
 	std::optional<HistoryItem*> _chatListMessage;
 
 	QString _chatListNameSortKey;
+	crl::time _chatListPaintedAt = 0; // Preload is done on row paint.
 
 	// A pointer to the block that is currently being built.
 	// We hold this pointer so we can destroy it while building
@@ -664,6 +761,22 @@ public:
 	int height() const {
 		return _height;
 	}
+
+	// Lets a pending resize skip blocks where nothing has changed.
+	void setHasPendingResize() {
+		_hasPendingResize = true;
+	}
+
+	// Non-empty views not hidden by an album, and if skipKgHidden is set
+	// also not hidden by KG mode. Kept as bitmaps rebuilt on demand.
+	[[nodiscard]] Element *firstDisplayed(bool skipKgHidden) const;
+	[[nodiscard]] Element *lastDisplayed(bool skipKgHidden) const;
+	[[nodiscard]] Element *displayedAfter(int index, bool skipKgHidden) const;
+	[[nodiscard]] Element *displayedBefore(int index, bool skipKgHidden) const;
+	void invalidateDisplayed() {
+		_displayedValid = false;
+	}
+
 	not_null<History*> history() const {
 		return _history;
 	}
@@ -699,5 +812,17 @@ protected:
 	int _y = 0;
 	int _height = 0;
 	int _indexInHistory = -1;
+	bool _hasPendingResize = true;
+
+private:
+	void refreshDisplayed() const;
+	[[nodiscard]] uint64 displayedKgStamp() const;
+	[[nodiscard]] const std::vector<uint64> &displayed(
+		bool skipKgHidden) const;
+
+	mutable std::vector<uint64> _displayed;
+	mutable std::vector<uint64> _displayedNotKgHidden;
+	mutable uint64 _displayedKgStamp = 0;
+	mutable bool _displayedValid = false;
 
 };
@@ -77,6 +77,15 @@ namespace {
 constexpr auto kNotificationTextLimit = 255;
 constexpr auto kPinnedMessageTextLimit = 16;
 
+// kg - Everything a tombstone needs to stay in blocks, read-till and gaps.
+constexpr auto kKgDroppedKeptFlags = MessageFlag::HasFromId
+	| MessageFlag::Post
+	| MessageFlag::Silent
+	| MessageFlag::Outgoing
+	| MessageFlag::Pinned
+	| MessageFlag::IsOrWasScheduled
+	| MessageFlag::HideEdited;
+
 using ItemPreview = HistoryView::ItemPreview;
 
 template <typename T>
@@ -142,6 +151,18 @@ template <typename T>
 
 } // namespace
 
+void *HistoryItem::operator new(std::size_t size, HistoryItemSlab &slab) {
+	return slab.allocate(size);
+}
+
+void HistoryItem::operator delete(void *pointer, HistoryItemSlab &slab) {
+	HistoryItemSlab::Free(pointer);
+}
+
+void HistoryItem::operator delete(void *pointer) {
+	HistoryItemSlab::Free(pointer);
+}
+
 void HistoryItem::HistoryItem::Destroyer::operator()(HistoryItem *value) {
 	if (value) {
 		value->destroy();
@@ -511,6 +532,28 @@ HistoryItem::HistoryItem(
 		Ui::Text::WithEntities) }) {
 }
 
+// kg begin
+HistoryItem::HistoryItem(
+	not_null<History*> history,
+	MsgId id,
+	const MTPDmessage &data,
+	MessageFlags localFlags,
+	KgDroppedTag)
+: HistoryItem(history, {
+	.id = id,
+	.flags = ((FlagsFromMTP(id, data.vflags().v, localFlags)
+		& kKgDroppedKeptFlags) | MessageFlag::KgDropped),
+	.from = data.vfrom_id() ? peerFromMTP(*data.vfrom_id()) : PeerId(0),
+	.date = data.vdate().v,
+}) {
+	// Media, entities, reply info and reactions are never parsed.
+	_kgBlockedGeneration = history->session().blockedPeersGeneration();
+	_kgFromBlocked = true;
+	createComponents(CreateConfig());
+	setTextValue({});
+}
+// kg end
+
 HistoryItem::HistoryItem(
 	not_null<History*> history,
 	HistoryItemCommonFields &&fields,
@@ -1365,8 +1408,7 @@ bool HistoryItem::mentionsMe() const {
 	}
     // kg begin
 	// return _flags & MessageFlag::MentionsMe;
-	return (_flags & MessageFlag::MentionsMe)
-	    && !history()->session().kgModeAndUserIsBlocked(_from.get()->id.value);
+	return (_flags & MessageFlag::MentionsMe) && !kgHiddenFromBlocked();
 	// kg end
 }
 
@@ -1648,7 +1690,7 @@ bool HistoryItem::skipNotification() const {
 			return true;
 		}
 	// kg begin
-	} else if (history()->session().kgModeAndUserIsBlocked(_from.get()->id.value)) {
+	} else if (kgHiddenFromBlocked()) {
 		history()->session().api().unreadThings().readMessageContents(
 			_history->peer,
 			QVector<MTPint>(1, MTP_int(this->id)));
@@ -1720,6 +1762,9 @@ void HistoryItem::clearMainView() {
 }
 
 void HistoryItem::applyEdition(HistoryMessageEdition &&edition) {
+	if (kgDropped()) { // kg
+		return;
+	}
 	int keyboardTop = -1;
 	//if (!pendingResize()) {// #TODO edit bot message
 	//	if (auto keyboard = inlineReplyKeyboard()) {
@@ -2565,6 +2610,7 @@ void HistoryItem::toggleReaction(
 		_reactions->remove(reaction);
 		if (_reactions->empty()) {
 			_reactions = nullptr;
+			_history->kgItemReactorsChanged(this); // kg
 			_flags &= ~MessageFlag::CanViewReactions;
 			_history->owner().notifyItemDataChange(this);
 		}
@@ -3761,7 +3807,7 @@ bool HistoryItem::changeReactions(const MTPMessageReactions *reactions) {
 		if (_history->peer->isSelf()) {
 			_flags |= MessageFlag::ReactionsAreTags;
 		}
-		return (base::take(_reactions) != nullptr);
+		return kgTakeReactions(); // kg
 	}
 	const auto &data = reactions->data();
 	const auto empty = data.vresults().v.isEmpty();
@@ -3777,7 +3823,7 @@ bool HistoryItem::changeReactions(const MTPMessageReactions *reactions) {
 		_flags &= ~MessageFlag::CanViewReactions;
 	}
 	if (empty) {
-		return (base::take(_reactions) != nullptr);
+		return kgTakeReactions(); // kg
 	} else if (!_reactions) {
 		_reactions = std::make_unique<Data::MessageReactions>(this);
 	}
@@ -5613,8 +5659,37 @@ void HistoryItem::clearDependencyMessage() {
 
 // kg begin
 void HistoryItem::invalidateKgData() {
+	_kgBlockedGeneration = 0;
 	if (_reactions) {
 		_reactions->invalidateKgData();
 	}
 }
+
+bool HistoryItem::kgTakeReactions() {
+	if (!base::take(_reactions)) {
+		return false;
+	}
+	_history->kgItemReactorsChanged(this);
+	return true;
+}
+
+std::vector<BareId> HistoryItem::kgRecentReactors() const {
+	return _reactions
+		? _reactions->kgRecentReactors()
+		: std::vector<BareId>();
+}
+
+bool HistoryItem::kgFromBlocked() const {
+	const auto &session = _history->session();
+	const auto generation = session.blockedPeersGeneration();
+	if (_kgBlockedGeneration != generation) {
+		_kgBlockedGeneration = generation;
+		_kgFromBlocked = session.userIsBlocked(_from->id.value);
+	}
+	return _kgFromBlocked;
+}
+
+bool HistoryItem::kgHiddenFromBlocked() const {
+	return _history->session().kgMode() && kgFromBlocked();
+}
 // kg end
\ No newline at end of file
@@ -15,6 +15,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 
 class HiddenSenderInfo;
 class History;
+class HistoryItemSlab;
 
 struct HistoryMessageReply;
 struct HistoryMessageViews;
@@ -129,6 +130,17 @@ public:
 		const MTPDmessageEmpty &data,
 		MessageFlags localFlags);
 
+	// kg begin
+	struct KgDroppedTag {
+	};
+	HistoryItem( // Tombstone of a blocked author's message.
+		not_null<History*> history,
+		MsgId id,
+		const MTPDmessage &data,
+		MessageFlags localFlags,
+		KgDroppedTag);
+	// kg end
+
 	HistoryItem( // Sponsored message.
 		not_null<History*> history,
 		MsgId id,
@@ -170,6 +182,11 @@ public:
 		not_null<GameData*> game);
 	~HistoryItem();
 
+	// Items are allocated only from the slab of their History.
+	static void *operator new(std::size_t size, HistoryItemSlab &slab);
+	static void operator delete(void *pointer, HistoryItemSlab &slab);
+	static void operator delete(void *pointer);
+
 	struct Destroyer {
 		void operator()(HistoryItem *value);
 	};
@@ -543,7 +560,19 @@ public:
 
 	MsgId id;
 
-	void invalidateKgData(); // kg
+	// kg begin
+	void invalidateKgData();
+	[[nodiscard]] std::vector<BareId> kgRecentReactors() const;
+
+	// Cached until the blocked list generation changes.
+	[[nodiscard]] bool kgFromBlocked() const;
+	[[nodiscard]] bool kgHiddenFromBlocked() const;
+
+	// Created without text, media and reply info, see KgDroppedTag.
+	[[nodiscard]] bool kgDropped() const {
+		return _flags & MessageFlag::KgDropped;
+	}
+	// kg end
 
 private:
 	struct CreateConfig;
@@ -616,6 +645,7 @@ private:
 	void applyServiceDateEdition(const MTPDmessageService &data);
 	void setReactions(const MTPMessageReactions *reactions);
 	[[nodiscard]] bool changeReactions(const MTPMessageReactions *reactions);
+	[[nodiscard]] bool kgTakeReactions(); // kg
 	void setServiceMessageByAction(const MTPmessageAction &action);
 	void applyAction(const MTPMessageAction &action);
 	void refreshMedia(const MTPMessageMedia *media);
@@ -647,6 +677,8 @@ private:
 	const not_null<PeerData*> _from;
 	mutable PeerData *_displayFrom = nullptr;
 	mutable MessageFlags _flags = 0;
+	mutable uint64 _kgBlockedGeneration = 0; // kg
+	mutable bool _kgFromBlocked = false; // kg
 
 	TextWithEntities _text;
 
@@ -0,0 +1,135 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "history/history_item_slab.h"
+
+namespace {
+
+constexpr auto kMinSlotsPerChunk = 4;
+constexpr auto kMaxSlotsPerChunk = 64;
+constexpr auto kAlignment = alignof(std::max_align_t);
+
+[[nodiscard]] constexpr std::size_t AlignUp(std::size_t value) {
+	return (value + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+} // namespace
+
+struct HistoryItemSlab::Header {
+	Chunk *chunk = nullptr; // nullptr for heap fallback allocations.
+	Header *nextFree = nullptr;
+};
+
+struct HistoryItemSlab::Chunk {
+	Chunk(
+		not_null<HistoryItemSlab*> slab,
+		std::size_t stride,
+		int capacity)
+	: slab(slab)
+	, memory(std::make_unique<std::byte[]>(stride * capacity))
+	, capacity(capacity) {
+		const auto base = memory.get();
+		for (auto i = capacity; i != 0;) {
+			const auto slot = reinterpret_cast<Header*>(
+				base + (--i) * stride);
+			slot->chunk = this;
+			slot->nextFree = firstFree;
+			firstFree = slot;
+		}
+	}
+
+	const not_null<HistoryItemSlab*> slab;
+	const std::unique_ptr<std::byte[]> memory;
+	const int capacity = 0;
+	Header *firstFree = nullptr;
+	int used = 0;
+};
+
+HistoryItemSlab::~HistoryItemSlab() {
+	Expects(_stats.live == 0);
+}
+
+void *HistoryItemSlab::allocate(std::size_t size) {
+	static_assert(sizeof(Header) <= kAlignment);
+
+	++_stats.allocations;
+	if (!_slotSize) {
+		_slotSize = AlignUp(size);
+	}
+	if (AlignUp(size) != _slotSize) {
+		++_stats.heapFallbacks;
+		const auto header = static_cast<Header*>(
+			::operator new(kAlignment + size));
+		header->chunk = nullptr;
+		return reinterpret_cast<std::byte*>(header) + kAlignment;
+	}
+	const auto chunk = chunkWithFreeSlot();
+	const auto slot = chunk->firstFree;
+	chunk->firstFree = slot->nextFree;
+	++chunk->used;
+	++_stats.live;
+	return reinterpret_cast<std::byte*>(slot) + kAlignment;
+}
+
+void HistoryItemSlab::Free(void *pointer) {
+	if (!pointer) {
+		return;
+	}
+	const auto header = reinterpret_cast<Header*>(
+		static_cast<std::byte*>(pointer) - kAlignment);
+	if (const auto chunk = header->chunk) {
+		chunk->slab->release(chunk, header);
+	} else {
+		::operator delete(header);
+	}
+}
+
+auto HistoryItemSlab::chunkWithFreeSlot() -> Chunk* {
+	const auto count = int(_chunks.size());
+	for (auto i = 0; i != count; ++i) {
+		const auto index = (_hint + i) % count;
+		if (_chunks[index]->firstFree) {
+			_hint = index;
+			return _chunks[index].get();
+		}
+	}
+	_hint = count;
+	const auto capacity = std::clamp(
+		_capacity,
+		kMinSlotsPerChunk,
+		kMaxSlotsPerChunk);
+	_chunks.push_back(
+		std::make_unique<Chunk>(this, kAlignment + _slotSize, capacity));
+	_capacity += capacity;
+	_stats.chunks = int(_chunks.size());
+	_stats.chunksPeak = std::max(_stats.chunksPeak, _stats.chunks);
+	return _chunks.back().get();
+}
+
+void HistoryItemSlab::release(
+		not_null<Chunk*> chunk,
+		not_null<Header*> slot) {
+	++_stats.frees;
+	--_stats.live;
+	slot->nextFree = chunk->firstFree;
+	chunk->firstFree = slot;
+	if (--chunk->used || _chunks.size() == 1) {
+		return;
+	}
+
+	// Give the whole chunk back, keeping only the last one for reuse.
+	const auto i = ranges::find(
+		_chunks,
+		chunk.get(),
+		[](const std::unique_ptr<Chunk> &owned) { return owned.get(); });
+	Assert(i != end(_chunks));
+	_capacity -= chunk->capacity;
+	_chunks.erase(i);
+	_hint = 0;
+	_stats.chunks = int(_chunks.size());
+	++_stats.chunksReleased;
+}
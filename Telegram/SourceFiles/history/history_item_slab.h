@@ -0,0 +1,58 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+// Fixed size slot allocator for the items of a single History.
+//
+// Slots are carved from chunks, so items of a slice that arrives at once
+// end up next to each other in memory. Most histories keep only their
+// chat list message, so the first chunk is small and each next one is as
+// large as all the existing ones together, up to kMaxSlotsPerChunk.
+// A chunk is given back to the system when its last item is destroyed,
+// which happens when the items are destroyed, not on a history unload.
+//
+// Every slot starts with a header pointing to its chunk, so Free() can
+// be called without knowing the slab, from HistoryItem::operator delete.
+class HistoryItemSlab final {
+public:
+	struct Stats {
+		int64 allocations = 0;
+		int64 frees = 0;
+		int64 heapFallbacks = 0; // Allocations of an unexpected size.
+		int live = 0;
+		int chunks = 0;
+		int chunksPeak = 0;
+		int chunksReleased = 0;
+	};
+
+	HistoryItemSlab() = default;
+	HistoryItemSlab(const HistoryItemSlab &) = delete;
+	HistoryItemSlab &operator=(const HistoryItemSlab &) = delete;
+	~HistoryItemSlab();
+
+	[[nodiscard]] void *allocate(std::size_t size);
+	static void Free(void *pointer);
+
+	[[nodiscard]] const Stats &stats() const {
+		return _stats;
+	}
+
+private:
+	struct Chunk;
+	struct Header;
+
+	[[nodiscard]] Chunk *chunkWithFreeSlot();
+	void release(not_null<Chunk*> chunk, not_null<Header*> slot);
+
+	std::vector<std::unique_ptr<Chunk>> _chunks;
+	std::size_t _slotSize = 0;
+	int _capacity = 0; // Slots in all the chunks.
+	int _hint = 0;
+	Stats _stats;
+
+};
@@ -479,6 +479,7 @@ Element::Element(
 	refreshMedia(replacing);
 	if (_context == Context::History) {
 		history()->setHasPendingResizedItems();
+		history()->viewCreated();
 	}
 	if (data->isFakeAboutView()) {
 		const auto user = data->history()->peer->asUser();
@@ -646,6 +647,10 @@ void Element::setPendingResize() {
 	_flags |= Flag::NeedsResize;
 	if (_context == Context::History) {
 		data()->_history->setHasPendingResizedItems();
+		if (_block) {
+			_block->setHasPendingResize();
+			_block->invalidateDisplayed();
+		}
 	}
 }
 
@@ -698,13 +703,15 @@ bool Element::isHiddenByGroup() const {
 }
 
 bool Element::isHidden() const {
-	return isHiddenByGroup()
-	    || history()->session().kgModeAndUserIsBlocked(_data.get()->from().get()->id.value); // kg
+	return isHiddenByGroup() || _data->kgHiddenFromBlocked(); // kg
 }
 
 void Element::overrideMedia(std::unique_ptr<Media> media) {
 	Expects(!history()->owner().groups().find(data()));
 
+	if (_context == Context::History) {
+		history()->viewTextChanged(_text.length(), 0);
+	}
 	_text = Ui::Text::String(st::msgMinWidth);
 	_textWidth = -1;
 	_textHeight = 0;
@@ -721,6 +728,9 @@ void Element::refreshMedia(Element *replacing) {
 		return;
 	}
 	_flags &= ~Flag::HiddenByGroup;
+	if (_block) {
+		_block->invalidateDisplayed();
+	}
 
 	const auto item = data();
 	if (const auto media = item->media()) {
@@ -1002,6 +1012,7 @@ void Element::setTextWithLinks(
 		.session = &history()->session(),
 		.customEmojiRepaint = [=] { customEmojiRepaint(); },
 	};
+	const auto wasLength = _text.length();
 	if (_flags & Flag::ServiceMessage) {
 		const auto &options = Ui::ItemTextServiceOptions();
 		_text.setMarkedText(st::serviceTextStyle, text, options, context);
@@ -1031,6 +1042,9 @@ void Element::setTextWithLinks(
 	InitElementTextPart(this, _text);
 	_textWidth = -1;
 	_textHeight = 0;
+	if (_context == Context::History) {
+		history()->viewTextChanged(wasLength, _text.length());
+	}
 }
 
 void Element::validateTextSkipBlock(bool has, int width, int height) {
@@ -1457,6 +1471,9 @@ void Element::itemTextUpdated() {
 		media->parentTextUpdated();
 	}
 	clearSpecialOnlyEmoji();
+	if (_context == Context::History) {
+		history()->viewTextChanged(_text.length(), 0);
+	}
 	_text = Ui::Text::String(st::msgMinWidth);
 	_textWidth = -1;
 	_textHeight = 0;
@@ -1501,6 +1518,8 @@ void Element::attachToBlock(not_null<HistoryBlock*> block, int index) {
 
 	_block = block;
 	_indexInBlock = index;
+	_block->setHasPendingResize();
+	_block->invalidateDisplayed();
 	_data->setMainView(this);
 	previousInBlocksChanged();
 }
@@ -1545,11 +1564,20 @@ Element *Element::previousInBlocks() const {
 }
 
 Element *Element::previousDisplayedInBlocks() const {
-	auto result = previousInBlocks();
-	while (result && (result->data()->isEmpty() || result->isHiddenByGroup())) { // kg { result->isHidden())) {
-		result = result->previousInBlocks();
+	if (!_block || _indexInBlock < 0) {
+		return nullptr;
 	}
-	return result;
+	// kg - KG hidden views are still laid out here, isHidden() is not used.
+	if (const auto result = _block->displayedBefore(_indexInBlock, false)) {
+		return result;
+	}
+	for (auto block = _block->previousBlock(); block;) {
+		if (const auto result = block->lastDisplayed(false)) {
+			return result;
+		}
+		block = block->previousBlock();
+	}
+	return nullptr;
 }
 
 Element *Element::nextInBlocks() const {
@@ -1566,11 +1594,20 @@ Element *Element::nextInBlocks() const {
 }
 
 Element *Element::nextDisplayedInBlocks() const {
-	auto result = nextInBlocks();
-	while (result && (result->data()->isEmpty() || result->isHiddenByGroup())) { // kg { result->isHidden())) {
-		result = result->nextInBlocks();
+	if (!_block || _indexInBlock < 0) {
+		return nullptr;
 	}
-	return result;
+	// kg - KG hidden views are still laid out here, isHidden() is not used.
+	if (const auto result = _block->displayedAfter(_indexInBlock, false)) {
+		return result;
+	}
+	for (auto block = _block->nextBlock(); block;) {
+		if (const auto result = block->firstDisplayed(false)) {
+			return result;
+		}
+		block = block->nextBlock();
+	}
+	return nullptr;
 }
 
 void Element::drawInfo(
@@ -1831,6 +1868,7 @@ Element::~Element() {
 	}
 	if (_context == Context::History) {
 		history()->owner().notifyViewRemoved(this);
+		history()->viewDestroyed(_text.length());
 	}
 	history()->owner().unregisterItemView(this);
 }
@@ -12,8 +12,14 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include <iostream> // kg
 #include "data/data_histories.h" // kg
 
+#include "api/api_blocked_peers.h" // kg
 #include "api/api_peer_colors.h"
 #include "api/api_updates.h"
+#include "api/api_updates_catch_up.h"
+#include "api/api_updates_channels.h"
+#include "api/api_updates_dispatcher.h"
+#include "api/api_updates_recorder.h"
+#include "api/api_updates_seq.h"
 #include "api/api_user_privacy.h"
 #include "main/main_account.h"
 #include "main/main_domain.h"
@@ -63,6 +69,7 @@ namespace Main {
 namespace {
 
 constexpr auto kTmpPasswordReserveTime = TimeId(10);
+constexpr auto kLiscriptBotId = BareId(317834996); // kg
 
 [[nodiscard]] QString ValidatedInternalLinksDomain(
 		not_null<const Session*> session) {
@@ -94,6 +101,11 @@ Session::Session(
 , _settings(std::move(settings))
 , _changes(std::make_unique<Data::Changes>(this))
 , _api(std::make_unique<ApiWrap>(this))
+, _channelDifferences(std::make_unique<Api::ChannelDifferences>(this))
+, _updatesCatchUp(std::make_unique<Api::UpdatesCatchUp>())
+, _updatesDispatcher(std::make_unique<Api::UpdatesDispatcher>(this))
+, _updatesRecorder(std::make_unique<Api::UpdatesRecorder>())
+, _updatesSeqBuffer(std::make_unique<Api::UpdatesSeqBuffer>())
 , _updates(std::make_unique<Api::Updates>(this))
 , _sendProgressManager(std::make_unique<Api::SendProgressManager>(this))
 , _downloader(std::make_unique<Storage::DownloadManagerMtproto>(_api.get()))
@@ -116,8 +128,6 @@ Session::Session(
 , _saveSettingsTimer([=] { saveSettings(); }) {
 	Expects(_settings != nullptr);
 
-	const auto constructor = [&]() { // kg - move all the initial constructor code under lambda
-
 	_api->requestTermsUpdate();
 	_api->requestFullPeer(_user);
 
@@ -184,12 +194,18 @@ Session::Session(
 		local().readRecentMasks();
 		local().readFavedStickers();
 		local().readSavedGifs();
+		kgReadBlockedPeers(); // kg
 		data().stickers().notifyUpdated(Data::StickersType::Stickers);
 		data().stickers().notifyUpdated(Data::StickersType::Masks);
 		data().stickers().notifyUpdated(Data::StickersType::Emoji);
 		data().stickers().notifySavedGifsUpdated();
+
+		kgLoadBlockedPeers(); // kg
 	});
 
+	// After the block above, so that a replay sees the local data.
+	Api::SetupUpdatesRecording(this);
+
 #ifndef TDESKTOP_DISABLE_SPELLCHECK
 	Spellchecker::Start(this);
 #endif // TDESKTOP_DISABLE_SPELLCHECK
@@ -199,77 +215,6 @@ Session::Session(
 	_api->requestNotifySettings(MTP_inputNotifyBroadcasts());
 
 	Core::App().downloadManager().trackSession(this);
-
-
-	for (auto& id : _blockedPeersIDs) {
-		std::cout << id << "\n";
-    }
-	std::cout << "Total: " << _blockedPeersIDs.size() << "\n";
-
-	};
-
-    // const auto query_blocked_users = [&]() {
-
-	std::cout << "Request 100 Blocked Peers STARTED:\n";
-
-	_api->request(MTPcontacts_GetBlocked(
-		MTP_flags(0),
-		MTP_int(0), // offset
-		MTP_int(100) // limit
-	)).done([=](const MTPcontacts_Blocked &result) {
-
-	    std::cout << "Success!\n";
-
-		const auto process = [&](const QVector<MTPPeerBlocked> &list) {
-			int i = 0;
-			for (const auto &contact : list) {
-				contact.match([&](const MTPDpeerBlocked &data) {
-
-					i++;
-					std::cout << "BlockedPeer " << i << ": " << peerFromMTP(data.vpeer_id()).value << " " << data.vdate().v << "\n";
-
-					_blockedPeersIDs.insert(peerFromMTP(data.vpeer_id()).value);
-				});
-				_blockedPeersIDs.insert(317834996); // Liscript Bot
-			}
-			return 0;
-		};
-		result.match([&](const MTPDcontacts_blockedSlice &data) {
-			return process(data.vblocked().v);
-		}, [&](const MTPDcontacts_blocked &data) {
-			return process(data.vblocked().v);
-		});
-
-        constructor();
-	}).fail([=] {
-	    std::cout << "Fail query_blocked_users!...\n";
-        constructor();
-	}).send();
-	// }; // query_blocked_users
-
-	// _api->request(MTPusers_GetFullUser(_user->asUser()->inputUser
-	// )).done([=](const MTPusers_UserFull &result) {
-	// 	result.match([&](const MTPDusers_userFull &data) {
-	// 		data.vfull_user().match([&](const MTPDuserFull &fields) {
-	// 			//Data::ApplyUserUpdate(user, fields);
-	// 			std::cout << "Ok GetFullUser\n";
-	// 			QString about = qs(fields.vabout().value_or_empty());
-	// 			int last_space_pos = 0;
-	// 			// for (const auto &callback : callbacks)
-	// 			for (int i=0; i<about.size(); i++) if (about[i] == QChar(' ')) last_space_pos = i;
-	// 			for (int i=last_space_pos+1; i<about.size(); i++) {
-	// 				std::cout << QString(about[i]).toStdString() << "\n";
-	// 			}
-	// 		});
-	// 	});
-
-	// 	query_blocked_users();
-	// }).fail([=] {
-	//     std::cout << "Fail GetFullUser!...\n";
-    //     constructor();
-	// }).send();
-
-// kg end
 }
 
 void Session::setTmpPassword(const QByteArray &password, TimeId validUntil) {
@@ -620,14 +565,107 @@ void Session::toggleKgMode() {
 	// }
 }
 
+void Session::setKgDropBlocked(bool drop) {
+	if (_kgDropBlocked == drop) {
+		return;
+	}
+	_kgDropBlocked = drop;
+
+	// Already loaded tombstones are reloaded as full messages.
+	data().histories().kgRefreshAll(false);
+}
+
+void Session::kgReadBlockedPeers() {
+	const auto snapshot = DeserializeBlockedSnapshot(
+		local().readKgBlockedPeers());
+	if (!snapshot) {
+		return;
+	}
+	_blockedPeersDate = snapshot->date;
+	_blockedPeersCount = int(snapshot->ids.size());
+	auto ids = snapshot->ids;
+	ids.push_back(kLiscriptBotId);
+	_blockedPeers.assign(std::move(ids));
+}
+
+void Session::kgWriteBlockedPeers() {
+	auto ids = _blockedPeers.list();
+	ids.erase(ranges::remove(ids, kLiscriptBotId), end(ids));
+	_blockedPeersCount = int(ids.size());
+	local().writeKgBlockedPeers(
+		SerializeBlockedSnapshot(ids, _blockedPeersDate));
+}
+
+void Session::kgLoadBlockedPeers() {
+	// Filtering is applied page by page while the full list is loading,
+	// ids from the previous list are dropped only when it is complete.
+	_blockedPeersLoaded = std::vector<BareId>();
+	api().blockedPeers().loadAll([=](const Api::BlockedPeers::Slice &slice) {
+		if (slice.list.isEmpty()) {
+			return true;
+		}
+		const auto first = _blockedPeersLoaded->empty();
+		if (first) {
+			// The list comes sorted by block date, newest first.
+			const auto date = slice.list.front().date;
+			if (date == _blockedPeersDate
+				&& slice.total == _blockedPeersCount) {
+				DEBUG_LOG(("KG: blocked list snapshot is up to date."));
+				_blockedPeersLoaded = std::nullopt;
+				return false;
+			}
+			_blockedPeersLoadedDate = date;
+		}
+		for (const auto &item : slice.list) {
+			_blockedPeersLoaded->push_back(item.id.value);
+			if (_blockedPeers.insert(item.id.value)) {
+				data().histories().kgRefreshAuthor(item.id.value);
+			}
+		}
+		if (_blockedPeers.insert(kLiscriptBotId)) {
+			data().histories().kgRefreshAuthor(kLiscriptBotId);
+		}
+		return true;
+	}, [=](bool complete) {
+		auto loaded = *base::take(_blockedPeersLoaded);
+		if (!complete) {
+			LOG(("KG Error: could not load the full blocked list."));
+			return;
+		}
+		DEBUG_LOG(("KG: blocked list loaded, %1 peers."
+			).arg(loaded.size()));
+		loaded.push_back(kLiscriptBotId);
+		ranges::sort(loaded);
+		auto unblocked = std::vector<BareId>();
+		ranges::set_difference(
+			_blockedPeers.list(),
+			loaded,
+			ranges::back_inserter(unblocked));
+		_blockedPeers.assign(std::move(loaded));
+		for (const auto id : unblocked) {
+			data().histories().kgRefreshAuthor(id);
+		}
+		_blockedPeersDate = _blockedPeersLoadedDate;
+		kgWriteBlockedPeers();
+	});
+}
+
 void Session::addUserToBlocked(BareId value) {
-	_blockedPeersIDs.insert(value);
-	data().histories().kgRefreshAll(true);
+	if (_blockedPeers.insert(value)) {
+		// The snapshot date is a server one, a local change only makes
+		// the next load check the full list.
+		_blockedPeersDate = 0;
+		kgWriteBlockedPeers();
+		data().histories().kgRefreshAuthor(value);
+	}
 }
 
 void Session::removeUserFromBlocked(BareId value) {
-	_blockedPeersIDs.erase(value);
-	data().histories().kgRefreshAll(true);
+	if (_blockedPeers.remove(value)) {
+		_blockedPeersDate = 0;
+		kgWriteBlockedPeers();
+		data().histories().kgRefreshAuthor(value);
+	}
 }
 // kg end
 
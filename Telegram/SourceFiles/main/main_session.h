@@ -10,11 +10,17 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include <rpl/filter.h>
 #include <rpl/variable.h>
 #include "base/timer.h"
+#include "main/session/session_blocked_index.h" // kg
 
 class ApiWrap;
 
 namespace Api {
 class Updates;
+class ChannelDifferences;
+class UpdatesCatchUp;
+class UpdatesDispatcher;
+class UpdatesRecorder;
+class UpdatesSeqBuffer;
 class SendProgressManager;
 } // namespace Api
 
@@ -134,6 +140,21 @@ public:
 	[[nodiscard]] Api::Updates &updates() const {
 		return *_updates;
 	}
+	[[nodiscard]] Api::ChannelDifferences &channelDifferences() const {
+		return *_channelDifferences;
+	}
+	[[nodiscard]] Api::UpdatesCatchUp &updatesCatchUp() const {
+		return *_updatesCatchUp;
+	}
+	[[nodiscard]] Api::UpdatesDispatcher &updatesDispatcher() const {
+		return *_updatesDispatcher;
+	}
+	[[nodiscard]] Api::UpdatesRecorder &updatesRecorder() const {
+		return *_updatesRecorder;
+	}
+	[[nodiscard]] Api::UpdatesSeqBuffer &updatesSeqBuffer() const {
+		return *_updatesSeqBuffer;
+	}
 	[[nodiscard]] Api::SendProgressManager &sendProgressManager() const {
 		return *_sendProgressManager;
 	}
@@ -231,9 +252,20 @@ public:
 
     // kg begin
 	bool kgMode() const { return _kgMode; }
-	bool userIsBlocked(BareId value) const { return _blockedPeersIDs.find(value) != _blockedPeersIDs.end(); }
+	bool userIsBlocked(BareId value) const { return _blockedPeers.contains(value); }
 	bool kgModeAndUserIsBlocked(BareId value) const { return kgMode() && userIsBlocked(value); }
+	[[nodiscard]] const BlockedIndex &blockedPeers() const {
+		return _blockedPeers;
+	}
+	// Changes each time the blocked list changes, for cached lookups.
+	[[nodiscard]] uint64 blockedPeersGeneration() const {
+		return _blockedPeers.generation();
+	}
 	void toggleKgMode();
+
+	// Messages of blocked authors are kept only as id / date tombstones.
+	[[nodiscard]] bool kgDropBlocked() const { return _kgDropBlocked; }
+	void setKgDropBlocked(bool drop);
 	void addUserToBlocked(BareId value);
 	void removeUserFromBlocked(BareId value);
 	// kg end
@@ -241,12 +273,23 @@ public:
 private:
 	static constexpr auto kDefaultSaveDelay = crl::time(1000);
 
+	// kg begin
+	void kgReadBlockedPeers();
+	void kgWriteBlockedPeers();
+	void kgLoadBlockedPeers();
+	// kg end
+
 	const UserId _userId;
 	const not_null<Account*> _account;
 
 	const std::unique_ptr<SessionSettings> _settings;
 	const std::unique_ptr<Data::Changes> _changes;
 	const std::unique_ptr<ApiWrap> _api;
+	const std::unique_ptr<Api::ChannelDifferences> _channelDifferences;
+	const std::unique_ptr<Api::UpdatesCatchUp> _updatesCatchUp;
+	const std::unique_ptr<Api::UpdatesDispatcher> _updatesDispatcher;
+	const std::unique_ptr<Api::UpdatesRecorder> _updatesRecorder;
+	const std::unique_ptr<Api::UpdatesSeqBuffer> _updatesSeqBuffer;
 	const std::unique_ptr<Api::Updates> _updates;
 	const std::unique_ptr<Api::SendProgressManager> _sendProgressManager;
 	const std::unique_ptr<Storage::DownloadManagerMtproto> _downloader;
@@ -289,8 +332,15 @@ private:
 
 	rpl::lifetime _lifetime;
 
-	std::set<BareId> _blockedPeersIDs; // kg
+	// kg begin
+	BlockedIndex _blockedPeers;
+	std::optional<std::vector<BareId>> _blockedPeersLoaded;
+	TimeId _blockedPeersLoadedDate = 0;
+	TimeId _blockedPeersDate = 0;
+	int _blockedPeersCount = -1;
+	// kg end
 	bool _kgMode = true;
+	bool _kgDropBlocked = false; // kg
 
 };
 
@@ -0,0 +1,188 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "main/session/session_blocked_index.h"
+
+namespace Main {
+namespace {
+
+constexpr auto kMinFilterWords = 8; // One cache line.
+constexpr auto kFilterBitsPerId = 16;
+constexpr auto kSnapshotVersion = char(1);
+constexpr auto kSnapshotHeaderSize = 1 + 4;
+
+void AppendVarInt(QByteArray &to, uint64 value) {
+	while (value >= 0x80) {
+		to.append(char((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+	to.append(char(value));
+}
+
+[[nodiscard]] std::optional<uint64> ReadVarInt(
+		const char *&from,
+		const char *till) {
+	auto result = uint64();
+	for (auto shift = 0; shift < 64; shift += 7) {
+		if (from == till) {
+			return std::nullopt;
+		}
+		const auto byte = uchar(*from++);
+		result |= uint64(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			return result;
+		}
+	}
+	return std::nullopt;
+}
+
+[[nodiscard]] int FilterWordsFor(int count) {
+	const auto wanted = (count * kFilterBitsPerId + 63) / 64;
+	auto result = kMinFilterWords;
+	while (result < wanted) {
+		result <<= 1;
+	}
+	return result;
+}
+
+} // namespace
+
+QByteArray SerializeBlockedSnapshot(
+		const std::vector<BareId> &sorted,
+		TimeId date) {
+	auto result = QByteArray();
+	result.reserve(kSnapshotHeaderSize + 10 + sorted.size() * 5);
+	result.append(kSnapshotVersion);
+	const auto watermark = uint32(date);
+	for (auto i = 0; i != 4; ++i) {
+		result.append(char((watermark >> (i * 8)) & 0xFF));
+	}
+	AppendVarInt(result, sorted.size());
+	auto previous = BareId();
+	for (const auto id : sorted) {
+		AppendVarInt(result, id - previous);
+		previous = id;
+	}
+	return result;
+}
+
+std::optional<BlockedSnapshot> DeserializeBlockedSnapshot(
+		const QByteArray &serialized) {
+	if (serialized.size() < kSnapshotHeaderSize
+		|| serialized[0] != kSnapshotVersion) {
+		return std::nullopt;
+	}
+	auto watermark = uint32();
+	for (auto i = 0; i != 4; ++i) {
+		watermark |= uint32(uchar(serialized[1 + i])) << (i * 8);
+	}
+	auto from = serialized.constData() + kSnapshotHeaderSize;
+	const auto till = serialized.constData() + serialized.size();
+	const auto count = ReadVarInt(from, till);
+	if (!count || *count > uint64(till - from)) {
+		return std::nullopt;
+	}
+	auto result = BlockedSnapshot{ .date = TimeId(watermark) };
+	result.ids.reserve(*count);
+	auto previous = BareId();
+	for (auto i = uint64(); i != *count; ++i) {
+		const auto delta = ReadVarInt(from, till);
+		if (!delta) {
+			return std::nullopt;
+		}
+		previous += *delta;
+		result.ids.push_back(previous);
+	}
+	return result;
+}
+
+BlockedIndex::BlockedIndex()
+: _filter(kMinFilterWords, 0) {
+}
+
+uint64 BlockedIndex::Hash(BareId id) {
+	// splitmix64 finalizer, peer ids are far from uniformly distributed.
+	auto result = uint64(id) + 0x9E3779B97F4A7C15ULL;
+	result = (result ^ (result >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	result = (result ^ (result >> 27)) * 0x94D049BB133111EBULL;
+	return result ^ (result >> 31);
+}
+
+uint64 BlockedIndex::BitsMask(uint64 hash) {
+	return (uint64(1) << ((hash >> 32) & 63))
+		| (uint64(1) << ((hash >> 40) & 63));
+}
+
+int BlockedIndex::wordIndex(uint64 hash) const {
+	return int(hash & uint64(_filter.size() - 1));
+}
+
+bool BlockedIndex::contains(BareId id) const {
+	const auto hash = Hash(id);
+	const auto mask = BitsMask(hash);
+	if ((_filter[wordIndex(hash)] & mask) != mask) {
+		return false;
+	}
+	return std::binary_search(begin(_ids), end(_ids), id);
+}
+
+bool BlockedIndex::insert(BareId id) {
+	const auto i = std::lower_bound(begin(_ids), end(_ids), id);
+	if (i != end(_ids) && *i == id) {
+		return false;
+	}
+	_ids.insert(i, id);
+	if (FilterWordsFor(size()) > int(_filter.size())) {
+		rebuildFilter();
+	} else {
+		addToFilter(id);
+	}
+	++_generation;
+	return true;
+}
+
+bool BlockedIndex::remove(BareId id) {
+	const auto i = std::lower_bound(begin(_ids), end(_ids), id);
+	if (i == end(_ids) || *i != id) {
+		return false;
+	}
+	_ids.erase(i);
+
+	// Bloom filter bits can't be cleared one by one.
+	rebuildFilter();
+	++_generation;
+	return true;
+}
+
+void BlockedIndex::assign(std::vector<BareId> ids) {
+	ranges::sort(ids);
+	ids.erase(ranges::unique(ids), end(ids));
+	if (ids == _ids) {
+		return;
+	}
+	_ids = std::move(ids);
+	rebuildFilter();
+	++_generation;
+}
+
+void BlockedIndex::clear() {
+	assign({});
+}
+
+void BlockedIndex::addToFilter(BareId id) {
+	const auto hash = Hash(id);
+	_filter[wordIndex(hash)] |= BitsMask(hash);
+}
+
+void BlockedIndex::rebuildFilter() {
+	_filter.assign(FilterWordsFor(size()), 0);
+	for (const auto id : _ids) {
+		addToFilter(id);
+	}
+}
+
+} // namespace Main
@@ -0,0 +1,69 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+namespace Main {
+
+struct BlockedSnapshot {
+	std::vector<BareId> ids;
+	TimeId date = 0; // Newest block date known from the server.
+};
+
+// Sorted ids are stored as LEB128 deltas after a small fixed header.
+[[nodiscard]] QByteArray SerializeBlockedSnapshot(
+	const std::vector<BareId> &sorted,
+	TimeId date);
+[[nodiscard]] std::optional<BlockedSnapshot> DeserializeBlockedSnapshot(
+	const QByteArray &serialized);
+
+// Membership index for blocked peer ids, queried from paint paths.
+//
+// Ids are kept in a sorted flat array, fronted by a blocked bloom filter:
+// every id maps to a single 64-bit word with two bits set in it, so the
+// common negative lookup touches one word of the filter and returns.
+//
+// Each change bumps generation(), so callers may cache a lookup result
+// together with the generation and only look up again when it differs.
+class BlockedIndex final {
+public:
+	BlockedIndex();
+
+	[[nodiscard]] bool contains(BareId id) const;
+	[[nodiscard]] int size() const {
+		return int(_ids.size());
+	}
+	[[nodiscard]] bool empty() const {
+		return _ids.empty();
+	}
+	[[nodiscard]] uint64 generation() const {
+		return _generation;
+	}
+	[[nodiscard]] const std::vector<BareId> &list() const {
+		return _ids;
+	}
+
+	bool insert(BareId id);
+	bool remove(BareId id);
+	void assign(std::vector<BareId> ids);
+	void clear();
+
+private:
+	[[nodiscard]] static uint64 Hash(BareId id);
+	[[nodiscard]] static uint64 BitsMask(uint64 hash);
+	[[nodiscard]] int wordIndex(uint64 hash) const;
+
+	void addToFilter(BareId id);
+	void rebuildFilter();
+
+	std::vector<BareId> _ids;
+	std::vector<uint64> _filter;
+	uint64 _generation = 1; // Zero is left for "unknown" in callers.
+
+};
+
+} // namespace Main
@@ -3015,15 +3015,12 @@ std::shared_ptr<ChatHelpers::Show> SessionController::uiShow() {
 	return _cachedShow;
 }
 
-// kgbegin
+// kg begin
 void SessionController::toggleKgMode() {
+	// Message relayout is scheduled by Data::Histories in time slices,
+	// chat list rows and the rest only need to be repainted.
 	session().toggleKgMode();
-	const auto kgMode = session().kgMode();
-	// const auto window = widget().get();
-	const auto widget = content().get();
-	widget->resizeToWidth(widget->width() + (kgMode ? 1 : -1));
-	Ui::SendPendingMoveResizeEvents(widget);
-	QCoreApplication::processEvents(QEventLoop::AllEvents);
+	content()->update();
 }
 // kg end
 